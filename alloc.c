@@ -0,0 +1,160 @@
+/*
+ * alloc.c -- check that items from an arena encode and print without
+ * calling the heap, once the arena has grown to size
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The program is linked with "-Wl,--wrap=malloc" and the like, so that
+ * all the heap calls of the library come here, and are counted. Each
+ * round creates the items from the arena, encodes them and prints
+ * them in every format, to a file and to memory, then resets the
+ * arena. The first round may grow the arena; the next ones must not
+ * call the heap at all. Usage: "alloc [<rounds>]"
+ */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+static int counting;
+static unsigned long heapcalls;
+
+void *__wrap_malloc(size_t size)
+{
+    heapcalls += counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    heapcalls += counting;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heapcalls += counting;
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    heapcalls += counting;
+    return __real_strdup(s);
+}
+
+static struct {
+    int flags;
+    char *text;
+} alloc_texts[] = {
+    {BARCODE_EAN,    "800894002700 12345"},
+    {BARCODE_UPC,    "07447084452"},
+    {BARCODE_UPC,    "012345"},
+    {BARCODE_ISBN,   "1-56592-292-1 90000"},
+    {BARCODE_39,     "SAMPLE CODES"},
+    {BARCODE_39EXT,  "Hello, world!"},
+    {BARCODE_128B,   "RBNLSN68T11E897W"},
+    {BARCODE_128C,   "12345678900123456789"},
+    {BARCODE_128,    "LOT2026-000001"},
+    {BARCODE_128 | BARCODE_SHORTEST, "abc123456def"},
+    {BARCODE_128RAW, "105 12 34 56"},
+    {BARCODE_I25,    "0123456789"},
+    {BARCODE_CBR,    "A12345B"},
+    {BARCODE_MSI,    "123456"},
+    {BARCODE_PLS,    "12AB"},
+    {BARCODE_93,     "CODE 93"},
+    {BARCODE_11,     "01234-56789"},
+    {0,              "800894002700"}, /* any: the classifier too */
+    {0,              NULL}
+};
+
+static int formats[] = {
+    BARCODE_OUT_PS | BARCODE_OUT_NOHEADERS,
+    BARCODE_OUT_PS,
+    BARCODE_OUT_EPS,
+    BARCODE_OUT_SVG,
+    BARCODE_OUT_PCL,
+};
+#define NFORMATS ((int)(sizeof(formats) / sizeof(formats[0])))
+
+static char outbuf[65536];
+
+int main(int argc, char **argv)
+{
+    struct Barcode_Arena *arena;
+    struct Barcode_Item *bc;
+    FILE *f;
+    int round, rounds = 10, i, j, errors = 0;
+
+    if (argc > 1)
+	rounds = atoi(argv[1]);
+    arena = Barcode_Arena_Create(0);
+    f = fopen("/dev/null", "w");
+    if (!arena || !f) {
+	perror(argv[0]);
+	return 1;
+    }
+    setvbuf(f, NULL, _IONBF, 0); /* stdio buffers are not ours */
+
+    for (round = 0; round < rounds; round++) {
+	heapcalls = 0;
+	counting = round > 0;
+	for (i = 0; alloc_texts[i].text; i++) {
+	    bc = Barcode_Create_Arena(alloc_texts[i].text, arena);
+	    if (!bc) {
+		errors++;
+		continue;
+	    }
+	    if (i % 2)
+		Barcode_Position(bc, 200, 60, 10, 10, 0.0);
+	    if (Barcode_Encode(bc, alloc_texts[i].flags) < 0) {
+		fprintf(stderr, "%s: can't encode \"%s\"\n", argv[0],
+			alloc_texts[i].text);
+		errors++;
+		continue;
+	    }
+	    if (!Barcode_Partial(bc) || !Barcode_Textinfo(bc))
+		errors++;
+	    for (j = 0; j < NFORMATS; j++) {
+		if (Barcode_Print(bc, f, formats[j]) < 0
+		    || Barcode_Print_Buffer(bc, outbuf, sizeof(outbuf),
+					    formats[j]) > (int)sizeof(outbuf))
+		    errors++;
+	    }
+	}
+	Barcode_Arena_Reset(arena);
+	counting = 0;
+	if (heapcalls) {
+	    fprintf(stderr, "%s: round %i: %lu heap calls\n", argv[0],
+		    round + 1, heapcalls);
+	    errors++;
+	}
+    }
+    fclose(f);
+    Barcode_Arena_Delete(arena);
+    printf("%s: %i rounds, %s\n", argv[0], rounds,
+	   errors ? "failed" : "no heap calls after the first");
+    return errors ? 1 : 0;
+}
@@ -31,30 +31,192 @@
 #define _(X) gettext (X)
 #define _N(X) (X)
 
+struct Barcode_Arena; /* see library.c */
+struct Barcode_Fragments; /* see library.c */
+struct Barcode_Resume; /* see library.c */
+struct Barcode_Range; /* see range.c */
+struct Barcode_Context;
+struct Barcode_Layout; /* see below */
+
+/*
+ * A char of the human-readable text, placed by the encoder
+ */
+struct Barcode_Glyph {
+    double x;          /* position, in bar units from the first run */
+    double size;       /* font size, before rescaling */
+    int c;             /* the char to print */
+    int above;         /* print above the bars, not below (add-ons) */
+};
+
 /*
  * The object
  */
 struct Barcode_Item {
     int flags;         /* type of encoding and decoding */
     char *ascii;       /* malloced */
-    char *partial;     /* malloced too */
-    char *textinfo;    /* information about text positioning */
-    char *encoding;    /* code name, filled by encoding engine */
+    char *partial;     /* malloced too, built on request */
+    char *textinfo;    /* the glyphs as a string, built on request */
+    char *encoding;    /* code name, filled by encoding engine (static) */
     int width, height; /* output units */
     int xoff, yoff;    /* output units */
     int margin;        /* output units */
     double scalef;     /* requested scaling for barcode */
     int error;         /* an errno-like value, in case of failure */
+    int errpos;        /* where the text can't be encoded, or -1 */
+    unsigned char *runs;     /* bar and space widths, space first */
+    unsigned char *runflags; /* BARCODE_RUN_* flags, one per run */
+    int nruns, runsize;      /* used and allocated runs */
+    struct Barcode_Glyph *glyphs; /* information about text positioning */
+    int nglyphs, glyphsize;       /* used and allocated glyphs */
+    struct Barcode_Arena *arena;  /* where memory comes from, or NULL */
+    struct Barcode_Context *context; /* the output stream, or NULL */
+    struct Barcode_Layout *layout;   /* built when printing, or NULL */
+};
+
+/*
+ * Where the bars and the chars go, computed once for all the backends
+ * (see layout.c). Units are points, scale included; x is counted from
+ * the left side of the item (xoff excluded), y from the bottom of the
+ * bars (yoff and margin excluded)
+ */
+struct Barcode_Bar {
+    double x, width;   /* left side (margin included) and width */
+    double y, top;     /* space left below and above the bar */
+    double height;
+};
+
+struct Barcode_Text {
+    double x;          /* margin excluded */
+    double y;          /* the baseline */
+    double size;       /* font size */
+    int c;
+};
+
+struct Barcode_Layout {
+    int valid;         /* cleared when the runs or the glyphs change */
+    int flags;         /* BARCODE_NO_ASCII, as it was */
+    int width, height; /* the fields of the item it was computed for */
+    int xoff, yoff, margin;
+    double scalef;
+    double scale;      /* the scale factor actually used */
+    double end;        /* where the last run ends */
+    struct Barcode_Bar *bars;
+    int nbars, barsize;
+    struct Barcode_Text *texts;
+    int ntexts, textsize;
+};
+
+/*
+ * A context: one item reused for every text printed to an output
+ * stream, with the state of the stream that outlives each item
+ */
+struct Barcode_Context {
+    struct Barcode_Item item; /* reset for each text */
+    int flags;         /* flags for each new text */
+    int asciisize;     /* allocated size of item.ascii */
+    int page;          /* current page, 0 before the first one */
+    double psfont;     /* PS font size in use, 0 if unknown */
+    double pclfont;    /* PCL font size in use, 0 if unknown */
+    int pclfontid;     /* and the PCL typeface it belongs to */
+    int pclcursor;     /* whether pclx and pcly are known */
+    double pclx, pcly; /* PCL cursor, from the top-left corner */
+    char *creator;     /* for the document header, NULL for the default */
+    char *paper;       /* name of the media, or NULL */
+    struct Barcode_Fragments *fragments; /* items already rendered, or NULL */
+    char *cachedir;    /* where fragments are kept across runs, or NULL */
+    size_t cachemax;   /* bytes allowed in cachedir, 0 for no limit */
+    unsigned long drawn, reused; /* items drawn, or copied from a fragment */
+    unsigned long loaded;        /* fragments read back from cachedir */
+    struct Barcode_Resume *resume; /* to encode the next text incrementally */
+};
+
+/*
+ * Where the output goes. The backends write to a sink, that collects
+ * the bytes in its buffer and passes them to the write function in
+ * chunks: to a FILE, to a buffer of the caller or to anything else
+ */
+#define BARCODE_SINK_BUFSIZE 1024
+
+struct Barcode_Sink {
+    int (*write)(void *arg, const char *data, size_t len); /* 0 or -1 */
+    void *arg;         /* passed to write */
+    size_t count;      /* bytes produced so far */
+    int error;         /* an errno-like value, after the first failure */
+    int len;           /* bytes waiting in buf */
+    char buf[BARCODE_SINK_BUFSIZE];
+};
+
+/*
+ * An output backend. Only draw_item is mandatory: documents and pages
+ * are only needed by output types that can hold several codes, and
+ * relocate by those that can reuse an item drawn at another place
+ * (see Barcode_Context_Fragments)
+ */
+struct Barcode_Backend {
+    char *name;
+    int (*begin_document)(struct Barcode_Context *ctx, struct Barcode_Sink *f);
+    int (*begin_page)(struct Barcode_Context *ctx, struct Barcode_Sink *f);
+    int (*draw_item)(struct Barcode_Item *bc, struct Barcode_Sink *f);
+    int (*end_page)(struct Barcode_Context *ctx, struct Barcode_Sink *f);
+    int (*end_document)(struct Barcode_Context *ctx, struct Barcode_Sink *f);
+    int (*relocate)(struct Barcode_Item *bc, struct Barcode_Sink *f,
+		    struct Barcode_Context *after);
 };
 
+/*
+ * The dimensions of an item, as it would be printed (see layout.c).
+ * Positions are points from the lower left corner of the bounding box,
+ * that is the area plus the margin on each side (xoff and yoff excluded)
+ */
+struct Barcode_Measure {
+    int barlen;        /* width of the runs, in bar units */
+    int nbars, ntexts; /* bars and chars to draw */
+    double scale;      /* points per bar unit */
+    int width, height; /* the area, as chosen by the layout */
+    int margin;        /* quiet zone on each side */
+    int boxwidth, boxheight; /* the bounding box, margins included */
+    double barx0, barx1;     /* left of the first bar, right of the last */
+    double texty0, texty1;   /* the lowest and highest baseline */
+    double textx0, textx1;   /* where the first and the last char begin */
+    double textsize;   /* the largest font size, 0 without text */
+};
+
+/*
+ * The counters of the cache of encoded texts (see library.c)
+ */
+struct Barcode_Cache_Stats {
+    unsigned long hits, misses, evictions;
+    int entries;       /* texts in the cache now */
+    int size;          /* how many it can hold */
+};
+
+/*
+ * Where an encoder was before a char of the text, so that it can go on
+ * from there when the next text of the context begins the same way
+ * (see Barcode_resume in library.c)
+ */
+struct Barcode_Checkpoint {
+    int nruns, nglyphs; /* filled by Barcode_checkpoint */
+    int sum;           /* the running checksum */
+    int state;         /* anything else the encoder needs */
+    double pos;        /* where the next glyph goes */
+};
+
+/*
+ * The runflags field
+ */
+#define BARCODE_RUN_LONG      0x01   /* bar extends lower than the others */
+#define BARCODE_RUN_ABOVE     0x02   /* text is printed above the bars */
+
 /*
  * The flags field
  */
 #define BARCODE_DEFAULT_FLAGS 0x00000000
 
 #define BARCODE_ENCODING_MASK 0x000000ff   /* 256 possibilites... */
-#define BARCODE_NO_ASCII      0x00000100   /* avoid text in output */
+#define BARCODE_NO_ASCII      0x00000100   /* avoid text in output (and glyphs) */
 #define BARCODE_NO_CHECKSUM   0x00000200   /* avoid checksum in output */
+#define BARCODE_SHORTEST      0x00000400   /* code 128: fewest symbols */
 
 #define BARCODE_OUTPUT_MASK   0x000ff000   /* 256 output types */
 #define BARCODE_OUT_EPS       0x00001000
@@ -64,6 +226,8 @@ struct Barcode_Item {
 #define BARCODE_OUT_PCL_III   0x0000C000
 #define BARCODE_OUT_SVG       0x00010000
 #define BARCODE_OUT_NOHEADERS 0x00100000   /* no header nor footer */
+#define BARCODE_OUT_STREAMING 0x00200000   /* PCL: embed in other PCL data */
+#define BARCODE_OUT_NOCOMMENTS 0x00400000  /* PS, SVG: no informative comments */
 
 enum {
     BARCODE_ANY = 0,     /* choose best-fit */
@@ -95,12 +259,138 @@ extern "C" {
 extern struct Barcode_Item *Barcode_Create(char *text);
 extern int                  Barcode_Delete(struct Barcode_Item *bc);
 
+/*
+ * Contexts: one item reused for many texts, for long-running programs
+ */
+extern struct Barcode_Context *Barcode_Context_Create(int flags);
+extern void                    Barcode_Context_Delete(struct Barcode_Context *ctx);
+extern struct Barcode_Item    *Barcode_Reset(struct Barcode_Context *ctx,
+					     char *text);
+extern int                     Barcode_Context_Page(struct Barcode_Context *ctx);
+extern int                     Barcode_Context_Fragments(struct Barcode_Context *ctx,
+							 int size);
+extern int                     Barcode_Context_Cache_Dir(struct Barcode_Context *ctx,
+							 char *dir, size_t maxsize);
+extern int                     Barcode_Context_Incremental(struct Barcode_Context *ctx,
+							   int on);
+
+/*
+ * Arenas: many items allocated and released at once
+ */
+extern struct Barcode_Arena *Barcode_Arena_Create(size_t size);
+extern void                  Barcode_Arena_Reset(struct Barcode_Arena *arena);
+extern void                  Barcode_Arena_Delete(struct Barcode_Arena *arena);
+extern struct Barcode_Item  *Barcode_Create_Arena(char *text,
+						  struct Barcode_Arena *arena);
+
 /*
  * Encode and print
  */
 extern int Barcode_Encode(struct Barcode_Item *bc, int flags);
 extern int Barcode_Print(struct Barcode_Item *bc, FILE *f, int flags);
 
+/*
+ * Print to memory: the return value is the size of the output, that
+ * was not stored if it is greater than "cap". Or print to any sink
+ */
+extern int Barcode_Print_Buffer(struct Barcode_Item *bc, char *buf, size_t cap,
+				int flags);
+extern int Barcode_Print_Sink(struct Barcode_Item *bc, struct Barcode_Sink *sink,
+			      int flags);
+
+/*
+ * Print one item to several streams, maybe in different formats: the
+ * encoding and the layout are shared. Each stream has its own flags
+ * and its own context (or NULL for none), as in Barcode_Print
+ */
+struct Barcode_Output {
+    FILE *f;
+    int flags;         /* output type and output flags */
+    struct Barcode_Context *context; /* the state of the stream, or NULL */
+};
+
+extern int Barcode_Print_Outputs(struct Barcode_Item *bc,
+				 struct Barcode_Output *out, int n);
+
+/*
+ * Sinks, for callers and for backends
+ */
+extern void Barcode_Sink_Init(struct Barcode_Sink *sink,
+			      int (*write)(void *arg, const char *data,
+					   size_t len),
+			      void *arg);
+extern int  Barcode_Sink_Write(struct Barcode_Sink *sink, const char *data,
+			       size_t len);
+extern int  Barcode_Sink_Printf(struct Barcode_Sink *sink, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__ ((format (printf, 2, 3)))
+#endif
+    ;
+extern int  Barcode_Sink_Flush(struct Barcode_Sink *sink);
+
+/*
+ * Check digits: the chars that an encoding appends to a text, and the
+ * verification of texts that end with them, one by one or in bulk
+ */
+extern int Barcode_Check_Chars(int type, char *text, int len, char *check);
+extern int Barcode_Check_Texts(int type, char **texts, int n,
+			       unsigned char *ok);
+extern int Barcode_Check_Block(int type, char *buf, int len, int stride,
+			       int n, unsigned char *ok);
+
+/*
+ * Tell which encodings can deal with a text, as a mask of classes
+ */
+#define BARCODE_CLASS(type) (1UL << (type))
+extern unsigned long Barcode_Classify(char *text);
+
+/*
+ * Generate the texts of a range of serial numbers
+ */
+extern struct Barcode_Range *Barcode_Range_Create(char *format,
+						  unsigned long start,
+						  unsigned long end,
+						  long step, int check);
+extern char *Barcode_Range_Next(struct Barcode_Range *range);
+extern void  Barcode_Range_Delete(struct Barcode_Range *range);
+
+/*
+ * Add encodings at run time, maybe loading them from plugins
+ */
+extern int   Barcode_Register_Encoding(int type, char *name,
+				       int (*verify)(char *text),
+				       int (*encode)(struct Barcode_Item *bc));
+extern int   Barcode_Encoding_Type(char *name);
+extern char *Barcode_Encoding_Name(int type);
+extern int   Barcode_Load_Encodings(char *path);
+
+/*
+ * Encode or verify many texts at once, using a pool of threads if available
+ */
+extern int Barcode_Encode_Batch(struct Barcode_Item **items, int n, int flags,
+				int nthreads);
+extern int Barcode_Verify_Batch(char **texts, int n, int flags, int nthreads,
+				int *errors, int *errpos);
+
+/*
+ * Keep the last encoded texts, to encode them again at no cost
+ */
+extern int  Barcode_Cache_Enable(int size);
+extern void Barcode_Cache_Get_Stats(struct Barcode_Cache_Stats *stats);
+
+/*
+ * Print whole documents, using the output type of the context
+ */
+extern int Barcode_Begin_Document(struct Barcode_Context *ctx, FILE *f);
+extern int Barcode_Begin_Page(struct Barcode_Context *ctx, FILE *f);
+extern int Barcode_End_Page(struct Barcode_Context *ctx, FILE *f);
+extern int Barcode_End_Document(struct Barcode_Context *ctx, FILE *f);
+
+/*
+ * Add output types at run time
+ */
+extern int Barcode_Register_Backend(int type, struct Barcode_Backend *backend);
+
 /*
  * Choose the position
  */
@@ -119,10 +409,58 @@ extern int Barcode_Encode_and_Print(char *text, FILE *f, int wid, int hei,
  */
 extern int Barcode_Version(char *versionname);
 
+/*
+ * Return the "partial" string, built from the runs on first use
+ */
+extern char *Barcode_Partial(struct Barcode_Item *bc);
+
+/*
+ * Return the "textinfo" string, built from the glyphs on first use
+ */
+extern char *Barcode_Textinfo(struct Barcode_Item *bc);
+
+/*
+ * Used by the backends: the layout, built on first use
+ */
+extern struct Barcode_Layout *Barcode_Get_Layout(struct Barcode_Item *bc);
+
+/*
+ * Encode (if needed) and lay out the item, without printing it
+ */
+extern int Barcode_Measure(struct Barcode_Item *bc, int flags,
+			   struct Barcode_Measure *m);
+
+/*
+ * Used by the encoders to allocate memory and to fill the runs and
+ * glyphs (see library.c)
+ */
+extern void *Barcode_malloc(struct Barcode_Item *bc, size_t size);
+extern void  Barcode_free(struct Barcode_Item *bc, void *ptr);
+extern char *Barcode_strdup(struct Barcode_Item *bc, char *s);
+extern int  Barcode_alloc_runs(struct Barcode_Item *bc, int n);
+extern void Barcode_add_runs(struct Barcode_Item *bc, char *pattern,
+			     int flags);
+extern int  Barcode_alloc_glyphs(struct Barcode_Item *bc, int n);
+extern void Barcode_add_glyph(struct Barcode_Item *bc, double x, double size,
+			      int c, int above);
+extern int  Barcode_text_error(struct Barcode_Item *bc, int pos);
+extern int  Barcode_verify_text(char *text,
+				int (*encode)(struct Barcode_Item *bc));
+extern int  Barcode_resume(struct Barcode_Item *bc, int tag, char *key,
+			   int len, int nruns, int nglyphs,
+			   struct Barcode_Checkpoint **cp);
+extern struct Barcode_Checkpoint *Barcode_checkpoint(struct Barcode_Item *bc,
+						     int i);
+extern void Barcode_resume_end(struct Barcode_Item *bc, char *key, int len);
+
+/*
+ * Shared by the encoders and the check digits (see checkdigit.c)
+ */
+extern char *Barcode_upc_e_to_a(char *text, char *result);
+extern int   Barcode_93_symbols(int ch, int *codes);
+
 #ifdef  __cplusplus
 }
 #endif
 
-extern int streaming;
-
 #endif /* _BARCODE_H_ */
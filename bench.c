@@ -0,0 +1,270 @@
+/*
+ * bench.c -- measure how fast barcodes are encoded
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/*
+ * Usage: "bench batch [<items> [<threads>]]" encodes the same mixed
+ * EAN, 128 and 39 items with Barcode_Encode_Batch and 1, 2, 4... up
+ * to <threads> threads, prints the items per second of each run and
+ * checks that the result is that of one thread.
+ *
+ * "bench length [<maxlen>]" encodes texts of 10, 100... up to <maxlen>
+ * chars with each encoding and prints the nanoseconds per char, that
+ * should not grow with the length.
+ *
+ * "bench check [<codes>]" verifies the same feed of EAN-13 codes, one
+ * per line and one in ten wrong, one by one with the verify function
+ * of the encoder (that computes the check digit with the rest of the
+ * parse), with Barcode_Check_Texts and with Barcode_Check_Block, and
+ * prints the nanoseconds per code of each
+ */
+
+static double bench_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static int bench_batch(int n, int maxthreads)
+{
+    static int types[] = {BARCODE_EAN, BARCODE_128, BARCODE_39};
+    struct Barcode_Item **items;
+    char **ref, text[32];
+    int i, nthreads, errors = 0;
+    double t;
+
+    items = malloc(n * sizeof(*items));
+    ref = malloc(n * sizeof(*ref));
+    if (!items || !ref) {
+	perror("bench");
+	return 1;
+    }
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+	/* the batch has one type, so each item gets its own */
+	for (i = 0; i < n; i++) {
+	    switch (types[i % 3]) {
+	    case BARCODE_EAN:
+		sprintf(text, "40063810%04d", i % 10000);
+		break;
+	    case BARCODE_128:
+		sprintf(text, "Lot %d/%06d", i % 97, i);
+		break;
+	    default:
+		sprintf(text, "P-%07d", i);
+	    }
+	    items[i] = Barcode_Create(text);
+	    items[i]->flags = types[i % 3];
+	}
+	t = bench_now();
+	if (Barcode_Encode_Batch(items, n, 0, nthreads))
+	    errors++;
+	t = bench_now() - t;
+	printf("threads %3i: %9.0f items/s\n", nthreads, n / t);
+	for (i = 0; i < n; i++) {
+	    if (nthreads == 1)
+		ref[i] = strdup(Barcode_Partial(items[i]));
+	    else if (strcmp(ref[i], Barcode_Partial(items[i])))
+		errors++;
+	    Barcode_Delete(items[i]);
+	}
+    }
+    for (i = 0; i < n; i++)
+	free(ref[i]);
+    free(ref);
+    free(items);
+    if (errors)
+	fprintf(stderr, "bench: %i items differ from one thread\n", errors);
+    return errors != 0;
+}
+
+static struct {
+    int type;
+    char *chars; /* the text repeats them */
+} bench_codes[] = {
+    {BARCODE_128B,   "ABCabc012"},
+    {BARCODE_128C,   "0123456789"},
+    {BARCODE_128,    "AB12345a\001c"},
+    {BARCODE_128RAW, NULL},
+    {BARCODE_39,     "ABC123"},
+    {BARCODE_39EXT,  "ABcd12"},
+    {BARCODE_93,     "ABC123"},
+    {BARCODE_I25,    "0123456789"},
+    {BARCODE_CBR,    "0123456789"},
+    {BARCODE_MSI,    "0123456789"},
+    {BARCODE_PLS,    "0123456789ABCDEF"},
+    {BARCODE_11,     "0123456789-"},
+    {0,              NULL}
+};
+
+/* "len" chars (or symbols, for 128raw) for the encoding "i" */
+static void bench_text(char *text, int i, int len)
+{
+    char *chars = bench_codes[i].chars;
+    int k, n, p = 0;
+
+    switch (bench_codes[i].type) {
+    case BARCODE_128RAW:
+	p = sprintf(text, "104");
+	for (k = 1; k < len; k++)
+	    p += sprintf(text + p, " %d", k % 100);
+	break;
+    case BARCODE_CBR: /* between start and stop chars */
+	text[p++] = 'A';
+	for (k = 0; k < len - 2; k++)
+	    text[p++] = chars[k % 10];
+	text[p++] = 'B';
+	break;
+    default:
+	n = strlen(chars);
+	for (k = 0; k < len; k++)
+	    text[p++] = chars[k % n];
+	if (bench_codes[i].type == BARCODE_I25 && p % 2)
+	    text[p++] = '1';
+    }
+    text[p] = '\0';
+}
+
+static int bench_length(int maxlen)
+{
+    struct Barcode_Item *bc;
+    char *text;
+    int i, k, len, reps, errors = 0;
+    double t;
+
+    text = malloc(6 * maxlen + 8);
+    if (!text) {
+	perror("bench");
+	return 1;
+    }
+    for (i = 0; bench_codes[i].type; i++) {
+	printf("%-7s", Barcode_Encoding_Name(bench_codes[i].type));
+	for (len = 10; len <= maxlen; len *= 10) {
+	    bench_text(text, i, len);
+	    reps = 200000 / len + 1;
+	    if (reps > 2000)
+		reps = 2000;
+	    t = bench_now();
+	    for (k = 0; k < reps; k++) {
+		bc = Barcode_Create(text);
+		if (Barcode_Encode(bc, bench_codes[i].type) < 0) {
+		    Barcode_Delete(bc);
+		    break;
+		}
+		Barcode_Delete(bc);
+	    }
+	    t = bench_now() - t;
+	    if (k < reps) {
+		printf(" %9s", "failed");
+		errors++;
+	    } else {
+		printf(" %9.1f", t / reps / len * 1e9);
+	    }
+	    fflush(stdout);
+	}
+	printf("  ns/char\n");
+    }
+    free(text);
+    return errors != 0;
+}
+
+/* not in barcode.h: the per-item path of Barcode_Encode() */
+extern int Barcode_ean_verify(char *text);
+
+static int bench_check(int n)
+{
+    char *buf, **texts, check[2];
+    unsigned char *ok;
+    int i, k, reps, wrong[3] = {0, 0, 0};
+    double t[3];
+
+    buf = malloc((size_t)n * 14);
+    texts = malloc(n * sizeof(*texts));
+    ok = malloc(n);
+    if (!buf || !texts || !ok) {
+	perror("bench");
+	return 1;
+    }
+    for (i = 0; i < n; i++) {
+	texts[i] = buf + (size_t)i * 14;
+	sprintf(texts[i], "400638%06d", i % 1000000);
+	Barcode_Check_Chars(BARCODE_EAN, texts[i], 12, check);
+	texts[i][12] = i % 10 ? check[0] : '0' + (check[0] - '0' + 1) % 10;
+	texts[i][13] = '\0';
+    }
+    reps = 10000000 / n + 1;
+
+    t[0] = bench_now();
+    for (k = 0; k < reps; k++)
+	for (i = wrong[0] = 0; i < n; i++)
+	    wrong[0] += Barcode_ean_verify(texts[i]) < 0;
+    t[0] = bench_now() - t[0];
+
+    t[1] = bench_now();
+    for (k = 0; k < reps; k++)
+	wrong[1] = Barcode_Check_Texts(BARCODE_EAN, texts, n, ok);
+    t[1] = bench_now() - t[1];
+
+    /* the same buffer, as the lines of a file */
+    for (i = 0; i < n; i++)
+	texts[i][13] = '\n';
+    t[2] = bench_now();
+    for (k = 0; k < reps; k++)
+	wrong[2] = Barcode_Check_Block(BARCODE_EAN, buf, 13, 14, n, ok);
+    t[2] = bench_now() - t[2];
+
+    printf("verify  %9.1f ns/code\n", t[0] / reps / n * 1e9);
+    printf("texts   %9.1f ns/code\n", t[1] / reps / n * 1e9);
+#ifdef __SSE2__
+    printf("block   %9.1f ns/code (sse2)\n", t[2] / reps / n * 1e9);
+#else
+    printf("block   %9.1f ns/code\n", t[2] / reps / n * 1e9);
+#endif
+    if (wrong[1] != wrong[0] || wrong[2] != wrong[0]) {
+	fprintf(stderr, "bench: %i, %i and %i wrong codes\n",
+		wrong[0], wrong[1], wrong[2]);
+	return 1;
+    }
+    free(ok);
+    free(texts);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "batch"))
+	return bench_batch(argc > 2 ? atoi(argv[2]) : 300000,
+			   argc > 3 ? atoi(argv[3]) : 8);
+    if (argc > 1 && !strcmp(argv[1], "length"))
+	return bench_length(argc > 2 ? atoi(argv[2]) : 100000);
+    if (argc > 1 && !strcmp(argv[1], "check"))
+	return bench_check(argc > 2 ? atoi(argv[2]) : 100000);
+    fprintf(stderr, "%s: use \"%s batch [<items> [<threads>]]\","
+	    " \"%s length [<maxlen>]\" or \"%s check [<codes>]\"\n",
+	    argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+}
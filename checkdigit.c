@@ -0,0 +1,394 @@
+/*
+ * checkdigit.c -- check digits and check chars, for one text or many
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#ifdef __SSE2__ /* always there on x86-64 */
+#  include <emmintrin.h>
+#endif
+
+/*
+ * The check chars are those the encoders append, computed in the same
+ * way (even where an encoder differs from the specification, so that
+ * the result matches what is printed). Code 93 has four check symbols
+ * that are not chars: they are returned as 'a' to 'd'
+ */
+static char checkbet39[] =
+   "0123456789" "ABCDEFGHIJ" "KLMNOPQRST" "UVWXYZ-. $" "/+%";
+static char checkbet93[] =
+   "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%abcd";
+static char checkbet11[] = "0123456789-";
+
+static int check_isdigits(char *text, int len)
+{
+    while (len-- > 0)
+	if (!isdigit((unsigned char)text[len]))
+	    return 0;
+    return 1;
+}
+
+/* the 3-1 weights of EAN and UPC, counted from the right */
+static int check_ean(char *text, int len)
+{
+    int i, sum = 0;
+
+    for (i = 0; i < len; i++)
+	sum += ((len - i) % 2 ? 3 : 1) * (text[i] - '0');
+    return '0' + (10 - sum % 10) % 10;
+}
+
+/*
+ * The check chars for the first "len" chars of "text", stored in
+ * "check" with a trailing null byte. Returns how many they are, or 0
+ * if the text can't have them
+ */
+static int check_chars(int type, char *text, int len, char *check)
+{
+    char upca[12], *s;
+    int i, j, n = 1, sum = 0, ksum = 0, codes[2];
+
+    switch (type) {
+    case BARCODE_EAN:
+	if ((len != 12 && len != 7) || !check_isdigits(text, len))
+	    return 0;
+	check[0] = check_ean(text, len);
+	break;
+
+    case BARCODE_UPC:
+	if (!check_isdigits(text, len))
+	    return 0;
+	if (len == 11) {
+	    check[0] = check_ean(text, len);
+	    break;
+	}
+	/* UPC-E: the check digit is the one of the UPC-A equivalent */
+	if (len == 6) {
+	    Barcode_upc_e_to_a(text, upca);
+	} else if (len == 7 && (text[0] == '0' || text[0] == '1')) {
+	    Barcode_upc_e_to_a(text + 1, upca);
+	    upca[0] = text[0];
+	} else {
+	    return 0;
+	}
+	check[0] = check_ean(upca, 11);
+	break;
+
+    case BARCODE_ISBN:
+	if ((len != 12 && len != 9) || !check_isdigits(text, len))
+	    return 0;
+	if (len == 12) {
+	    check[0] = check_ean(text, len);
+	    break;
+	}
+	for (i = 0; i < len; i++)
+	    sum += (10 - i) * (text[i] - '0');
+	sum = (11 - sum % 11) % 11;
+	check[0] = sum == 10 ? 'X' : '0' + sum;
+	break;
+
+    case BARCODE_39:
+	if (!len)
+	    return 0;
+	for (i = 0; i < len; i++) {
+	    if (text[i] == '*') /* the encoder skips it */
+		continue;
+	    if (!text[i] || !(s = strchr(checkbet39, toupper(text[i]))))
+		return 0;
+	    sum += s - checkbet39;
+	}
+	check[0] = checkbet39[sum % 43];
+	break;
+
+    case BARCODE_93:
+	if (!len)
+	    return 0;
+	/* the weights count the symbols from the right */
+	for (i = len - 1, j = 0; i >= 0; i--) {
+	    if (!text[i] || !(n = Barcode_93_symbols(text[i], codes)))
+		return 0;
+	    while (n--) {
+		j++;
+		sum += ((j - 1) % 20 + 1) * codes[n];
+		ksum += (j % 15 + 1) * codes[n];
+	    }
+	}
+	sum %= 47;
+	check[0] = checkbet93[sum];
+	check[1] = checkbet93[(ksum + sum) % 47];
+	n = 2;
+	break;
+
+    case BARCODE_11:
+	if (!len)
+	    return 0;
+	for (i = 1; i <= len; i++) {
+	    if (!text[len - i] || !(s = strchr(checkbet11, text[len - i])))
+		return 0;
+	    sum += ((i - 1) % 10 + 1) * (s - checkbet11);
+	    ksum += ((i - 1) % 9 + (i < 9 ? 2 : 1)) * (s - checkbet11);
+	}
+	check[0] = checkbet11[sum % 11];
+	if (len >= 10) { /* and the K check char, like the encoder */
+	    check[1] = checkbet11[(ksum + sum % 11) % 9];
+	    n = 2;
+	}
+	break;
+
+    case BARCODE_MSI:
+	if (!len || !check_isdigits(text, len))
+	    return 0;
+	for (i = 0; i < len; i++) {
+	    j = text[i] - '0';
+	    sum += (i ^ len) & 1 ? 2 * j + (2 * j) / 10 : j;
+	}
+	check[0] = '0' + (sum + 9) / 10 * 10 - sum;
+	break;
+
+    default:
+	return 0;
+    }
+    check[n] = '\0';
+    return n;
+}
+
+/* the encodings that have check chars */
+static int check_type(int type)
+{
+    switch (type) {
+    case BARCODE_EAN: case BARCODE_UPC: case BARCODE_ISBN:
+    case BARCODE_39: case BARCODE_93: case BARCODE_11: case BARCODE_MSI:
+	return 1;
+    }
+    return 0;
+}
+
+/* how many check chars a text of "len" chars ends with, or 0 */
+static int check_count(int type, int len)
+{
+    switch (type) {
+    case BARCODE_EAN:  return len == 13 || len == 8;
+    case BARCODE_UPC:  return len == 12 || len == 8 || len == 7;
+    case BARCODE_ISBN: return len == 13 || len == 10;
+    case BARCODE_39:
+    case BARCODE_MSI:  return len >= 2;
+    case BARCODE_93:   return len >= 3 ? 2 : 0;
+    case BARCODE_11:   return len >= 12 ? 2 : len >= 2 && len <= 10;
+    }
+    return 0;
+}
+
+/* whether the text ends with the right check chars */
+static int check_text(int type, char *text, int len)
+{
+    char check[3];
+    int n = check_count(type, len);
+
+    if (!n || check_chars(type, text, len - n, check) != n)
+	return 0;
+    if (type == BARCODE_39)
+	return toupper((unsigned char)text[len - 1]) == check[0];
+    return !memcmp(text + len - n, check, n);
+}
+
+/*
+ * The codes with a fixed length are a weighted sum of all the digits,
+ * the check digit too, that must be a multiple of the modulus
+ */
+struct check_kernel {
+    int type, len;     /* the text, with its check digit */
+    int mod;
+    int x;             /* the last digit may be 'X', for 10 */
+    short weights[16];
+};
+
+static struct check_kernel check_kernels[] = {
+    {BARCODE_EAN,  13, 10, 0, {1,3,1,3,1,3,1,3,1,3,1,3,1}},
+    {BARCODE_EAN,   8, 10, 0, {3,1,3,1,3,1,3,1}},
+    {BARCODE_UPC,  12, 10, 0, {3,1,3,1,3,1,3,1,3,1,3,1}},
+    {BARCODE_ISBN, 13, 10, 0, {1,3,1,3,1,3,1,3,1,3,1,3,1}},
+    {BARCODE_ISBN, 10, 11, 1, {10,9,8,7,6,5,4,3,2,1}},
+    {0,}
+};
+
+static struct check_kernel *check_kernel(int type, int len)
+{
+    struct check_kernel *k;
+
+    for (k = check_kernels; k->type; k++)
+	if (k->type == type && k->len == len)
+	    return k;
+    return NULL;
+}
+
+static int check_fixed(struct check_kernel *k, char *text)
+{
+    int i, d, sum = 0;
+
+    for (i = 0; i < k->len; i++) {
+	d = (unsigned char)text[i] - '0';
+	if (k->x && i == k->len - 1 && text[i] == 'X')
+	    d = 10;
+	else if (d < 0 || d > 9)
+	    return 0;
+	sum += k->weights[i] * d;
+    }
+    return sum % k->mod == 0;
+}
+
+#ifdef __SSE2__
+/*
+ * The same on 16 chars at once: those past the text are masked out,
+ * the digits are checked with an unsigned compare and the weighted sum
+ * is a multiply-add on 16-bit lanes
+ */
+struct check_vectors {
+    __m128i mask, xlane, wlo, whi;
+};
+
+static void check_vectors(struct check_kernel *k, struct check_vectors *v)
+{
+    char mask[16], xlane[16];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+	mask[i] = i < k->len ? -1 : 0;
+	xlane[i] = k->x && i == k->len - 1 ? -1 : 0;
+    }
+    v->mask = _mm_loadu_si128((__m128i *)mask);
+    v->xlane = _mm_loadu_si128((__m128i *)xlane);
+    v->wlo = _mm_loadu_si128((__m128i *)k->weights);
+    v->whi = _mm_loadu_si128((__m128i *)(k->weights + 8));
+}
+
+static int check_fixed_sse2(struct check_kernel *k, struct check_vectors *v,
+			    char *text)
+{
+    __m128i c = _mm_loadu_si128((__m128i *)text);
+    __m128i nine = _mm_set1_epi8(9), zero = _mm_setzero_si128();
+    __m128i d, x, ok, sum;
+
+    d = _mm_and_si128(_mm_sub_epi8(c, _mm_set1_epi8('0')), v->mask);
+    x = _mm_and_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('X')), v->xlane);
+    ok = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(d, nine), nine), x);
+    if (_mm_movemask_epi8(ok) != 0xffff)
+	return 0;
+    d = _mm_or_si128(_mm_andnot_si128(x, d),
+		     _mm_and_si128(x, _mm_set1_epi8(10)));
+
+    sum = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(d, zero), v->wlo),
+			_mm_madd_epi16(_mm_unpackhi_epi8(d, zero), v->whi));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum) % k->mod == 0;
+}
+#endif
+
+/*
+ * Store in "check" the check chars of "type" (BARCODE_EAN, _UPC, _ISBN,
+ * _39, _93, _11 or _MSI) for the first "len" chars of "text", and a
+ * null byte. Returns how many they are (1 or 2), or -1 with errno set
+ */
+int Barcode_Check_Chars(int type, char *text, int len, char *check)
+{
+    int n = check_chars(type, text, len, check);
+
+    if (!n) {
+	errno = EINVAL;
+	return -1;
+    }
+    return n;
+}
+
+/*
+ * Verify "n" texts that end with their check chars: ok[i] (if "ok" is
+ * not NULL) tells whether texts[i] is right. Returns how many are
+ * wrong, or -1 with errno set if the type has no check chars
+ */
+int Barcode_Check_Texts(int type, char **texts, int n, unsigned char *ok)
+{
+    struct check_kernel *k;
+    int i, len, res, wrong = 0;
+
+    if (!check_type(type)) {
+	errno = EINVAL;
+	return -1;
+    }
+    for (i = 0; i < n; i++) {
+	len = strlen(texts[i]);
+	if ((k = check_kernel(type, len)))
+	    res = check_fixed(k, texts[i]);
+	else
+	    res = check_text(type, texts[i], len);
+	wrong += !res;
+	if (ok)
+	    ok[i] = res;
+    }
+    return wrong;
+}
+
+/*
+ * The same for "n" texts of "len" chars each, "stride" bytes apart in
+ * "buf" (a file with one code per line, for example). This is the fast
+ * path for the fixed-length codes: the records are checked in place,
+ * with SSE2 if the processor has it
+ */
+int Barcode_Check_Block(int type, char *buf, int len, int stride, int n,
+			unsigned char *ok)
+{
+    struct check_kernel *k = check_kernel(type, len);
+    int i, res, wrong = 0;
+#ifdef __SSE2__
+    struct check_vectors v;
+    long size = len + (long)(n - 1) * stride;
+    int fast = 0; /* records that can be loaded 16 bytes at a time */
+#endif
+
+    if (!check_type(type) || len <= 0 || stride < len) {
+	errno = EINVAL;
+	return -1;
+    }
+#ifdef __SSE2__
+    memset(&v, 0, sizeof(v));
+    if (k && size >= 16) {
+	check_vectors(k, &v);
+	/* the 16 bytes at each record must be inside the buffer */
+	fast = (size - 16) / stride + 1;
+    }
+#endif
+    for (i = 0; i < n; i++, buf += stride) {
+#ifdef __SSE2__
+	if (i < fast)
+	    res = check_fixed_sse2(k, &v, buf);
+	else
+#endif
+	if (k)
+	    res = check_fixed(k, buf);
+	else
+	    res = check_text(type, buf, len);
+	wrong += !res;
+	if (ok)
+	    ok[i] = res;
+    }
+    return wrong;
+}
@@ -0,0 +1,207 @@
+/*
+ * classify.c -- tell which encodings can deal with a text
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each encoding has its own verify function, but calling them all in
+ * turn to find the best fit for a text means scanning it over and over.
+ * Here every char is looked up once in the table below, which says
+ * what the char is good for; the rules are the same as in the verify
+ * functions, so the results are the same too.
+ */
+#define C_DIGIT  0x0001   /* '0' to '9' */
+#define C_128B   0x0002   /* printable ascii, code 128-B */
+#define C_128    0x0004   /* code 128, with the 0xc1-0xc4 function chars */
+#define C_ASCII  0x0008   /* 7-bit ascii: code 39 extended, code 93 */
+#define C_39     0x0010   /* code 39, lowercase too */
+#define C_CBR    0x0020   /* codabar, lowercase too */
+#define C_CBRL   0x0040   /* codabar start/stop letters (a-d, A-D) */
+#define C_PLS    0x0080   /* plessey, lowercase too */
+#define C_11     0x0100   /* code 11 */
+#define C_UPPER  0x0200   /* uppercase letter */
+#define C_LOWER  0x0400   /* lowercase letter */
+#define C_RAW    0x0800   /* raw code 128: digits, blanks and signs */
+#define C_ISBN   0x1000   /* isbn: digits, '-', ' ' and 'X' */
+#define C_EAN    0x2000   /* ean and upc: digits and ' ' */
+#define C_WHITE  0x4000   /* blank space, as isspace() */
+
+static unsigned short classes[256] = {
+    0x0000, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x480c, 0x480c, 0x480c, 0x480c, 0x480c, 0x000c, 0x000c,
+    0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c, 0x000c,
+    0x781e, 0x000e, 0x000e, 0x000e, 0x003e, 0x001e, 0x000e, 0x000e, 0x000e, 0x000e, 0x001e, 0x083e, 0x000e, 0x193e, 0x003e, 0x003e,
+    0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x39bf, 0x002e, 0x000e, 0x000e, 0x000e, 0x000e, 0x000e,
+    0x000e, 0x02fe, 0x02fe, 0x02fe, 0x02fe, 0x029e, 0x029e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e,
+    0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x021e, 0x121e, 0x021e, 0x021e, 0x000e, 0x000e, 0x000e, 0x000e, 0x000e,
+    0x000e, 0x04fe, 0x04fe, 0x04fe, 0x04fe, 0x049e, 0x049e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e,
+    0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x041e, 0x141e, 0x041e, 0x041e, 0x000e, 0x000e, 0x000e, 0x000e, 0x000e,
+    0x0004, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0004, 0x0004, 0x0004, 0x0004, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+};
+
+/*
+ * The code 128 raw verify function uses sscanf("%u"): numbers may have
+ * a sign and blanks before them, but not after the last one
+ */
+#define RAW_START  0 /* before a number, maybe skipping blanks */
+#define RAW_SIGN   1 /* after a sign, a digit must follow */
+#define RAW_NUMBER 2 /* within a number */
+
+static int Barcode_raw_number(int neg, int val)
+{
+    /* "-0" is 0, any other negative number is huge when unsigned */
+    return val <= 105 && !(neg && val);
+}
+
+extern int Barcode_upc_verify(char *text);
+extern int Barcode_isbn_verify(char *text);
+
+/*
+ * The ean/upc check digit is the last one of the n+1 digits; "sum"
+ * holds the digits at even and odd positions. See ean_make_checksum()
+ */
+static int Barcode_ean_check(int *sum, int n, int last)
+{
+    int esum = sum[(n - 1) % 2], osum = sum[n % 2] - last;
+
+    return (10 - (3 * esum + osum) % 10) % 10 == last;
+}
+
+/*
+ * Return the set of encodings that can deal with the text, as a mask
+ * of BARCODE_CLASS() bits. Only the built-in encodings are considered
+ */
+unsigned long Barcode_Classify(char *text)
+{
+    unsigned char *s = (unsigned char *)text;
+    unsigned int all = ~0, any = 0, cls;
+    int i, midletters = 0, lastletter = 0;
+    int ndigits = 0, nspaces = 0, spc = -1, sum[2] = {0, 0};
+    int raw = RAW_START, neg = 0, val = 0, rawok = 1;
+    int len0, addon, last;
+    unsigned long mask = 0;
+
+    if (!s[0])
+	return 0;
+
+    for (i = 0; s[i]; i++) {
+	cls = classes[s[i]];
+	all &= cls;
+	any |= cls;
+	if (cls & C_DIGIT) {
+	    ndigits++;
+	    if (spc < 0) /* for the ean/upc checksum */
+		sum[i & 1] += s[i] - '0';
+	    if (raw != RAW_NUMBER) {
+		neg &= raw == RAW_SIGN;
+		val = 0;
+		raw = RAW_NUMBER;
+	    }
+	    if (val <= 105) /* bigger is bad anyways, don't overflow */
+		val = val * 10 + s[i] - '0';
+	    continue;
+	}
+	/* codabar letters are only allowed at both ends */
+	if ((cls & C_CBRL) && i) {
+	    midletters++;
+	    lastletter = i;
+	}
+	if (s[i] == ' ') {
+	    if (spc < 0)
+		spc = i;
+	    nspaces++;
+	}
+	if (!(cls & C_RAW))
+	    continue;
+	if (raw == RAW_NUMBER)
+	    rawok &= Barcode_raw_number(neg, val);
+	else if (raw == RAW_SIGN)
+	    rawok = 0; /* a sign must be followed by a digit */
+	if (cls & C_WHITE) {
+	    raw = RAW_START;
+	} else { /* a sign */
+	    neg = s[i] == '-';
+	    raw = RAW_SIGN;
+	}
+    }
+
+    /* ean and upc: digits, maybe a blank and an add-on of 2 or 5 */
+    len0 = spc < 0 ? i : spc;
+    addon = i - len0 - 1;
+    if (all & C_EAN && nspaces <= 1 && (spc < 0 || addon == 2 || addon == 5)) {
+	last = len0 ? s[len0 - 1] - '0' : 0; /* the check digit, if any */
+	switch (len0) {
+	case 8: case 13:
+	    if (!Barcode_ean_check(sum, len0 - 1, last))
+		break;
+	case 7: case 12:
+	    mask |= BARCODE_CLASS(BARCODE_EAN);
+	}
+	switch (len0) {
+	case 6: case 7: case 8: /* upc-e, not all of them are valid */
+	    if (!Barcode_upc_verify(text))
+		mask |= BARCODE_CLASS(BARCODE_UPC);
+	    break;
+	case 12:
+	    if (!Barcode_ean_check(sum, len0 - 1, last))
+		break;
+	case 11:
+	    mask |= BARCODE_CLASS(BARCODE_UPC);
+	}
+    }
+    /* isbn: 9 digits, the checksum and the add-on are optional */
+    if (all & C_ISBN && (ndigits == 9 || ndigits == 10 || ndigits >= 14)
+	&& !Barcode_isbn_verify(text))
+	mask |= BARCODE_CLASS(BARCODE_ISBN);
+    if (all & C_128B)
+	mask |= BARCODE_CLASS(BARCODE_128B);
+    if (all & C_DIGIT) {
+	if (i % 2 == 0)
+	    mask |= BARCODE_CLASS(BARCODE_128C);
+	mask |= BARCODE_CLASS(BARCODE_I25) | BARCODE_CLASS(BARCODE_MSI);
+    }
+    if (all & C_RAW && raw == RAW_NUMBER && rawok
+	&& Barcode_raw_number(neg, val))
+	mask |= BARCODE_CLASS(BARCODE_128RAW);
+    if (all & C_39 && (any & (C_UPPER | C_LOWER)) != (C_UPPER | C_LOWER))
+	mask |= BARCODE_CLASS(BARCODE_39);
+    if (all & C_ASCII)
+	mask |= BARCODE_CLASS(BARCODE_39EXT) | BARCODE_CLASS(BARCODE_93);
+    if (all & C_128)
+	mask |= BARCODE_CLASS(BARCODE_128);
+    if (all & C_CBR && (any & (C_UPPER | C_LOWER)) != (C_UPPER | C_LOWER)
+	&& (!midletters || (midletters == 1 && lastletter == i - 1
+			    && classes[s[0]] & C_CBRL)))
+	mask |= BARCODE_CLASS(BARCODE_CBR);
+    if (all & C_PLS && (any & (C_UPPER | C_LOWER)) != (C_UPPER | C_LOWER))
+	mask |= BARCODE_CLASS(BARCODE_PLS);
+    if (all & C_11)
+	mask |= BARCODE_CLASS(BARCODE_11);
+    return mask;
+}
@@ -43,6 +43,9 @@ static char *patterns[] = {
 "1113311","1133111","3111313","3131113","3131311",
 "1131313","1133131","1313113","1113133","1113331" };
 
+/* the verify function checks the text by encoding it */
+int Barcode_cbr_encode(struct Barcode_Item *bc);
+
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  * If it's all lowecase convert to uppercase and accept it.
@@ -51,106 +54,72 @@ static char *patterns[] = {
  */
 int Barcode_cbr_verify(char *text)
 {
-    int i, lower=0, upper=0;
-    int startpresent = 0;
-
-    if (!strlen(text))
-	return -1;
-    for (i=0; text[i]; i++) {
-	char * pos;
-        if (isupper(text[i])) upper++;
-        if (islower(text[i])) lower++;
-	pos = strchr(alphabet,toupper(text[i]));
-        if (!pos)
-            return -1;
-	if (i == 0 && pos - alphabet >= CODE_A)
-	    startpresent = 1;
-	else if (pos - alphabet >= CODE_A &&
-		 (!startpresent || i != strlen(text) - 1))
-	    return -1; 	
-    }
-    if (lower && upper)
-        return -1;
-    return 0;
+    return Barcode_verify_text(text, Barcode_cbr_encode);
 }
 
-static int add_one(char *ptr, int code)
+static int add_one(struct Barcode_Item *bc, int code)
 {
-    sprintf(ptr,"1%s", /* separator */ patterns[code]);
+    Barcode_add_runs(bc, "1", 0); /* separator */
+    Barcode_add_runs(bc, patterns[code], 0);
     return 0;
 }
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
+ * The encoding functions fills the "runs" and "glyphs" fields.
  * Lowercase chars are converted to uppercase
  */
 int Barcode_cbr_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *c, *ptr, *textptr;
-    int i, code, textpos, usesum, checksum = 0, startpresent;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    char *text;
+    char *c;
+    int i, len, code, textpos, usesum, checksum = 0, startpresent;
+    int lower = 0, upper = 0;
 
     if (!bc->encoding)
-	bc->encoding = strdup("codabar");
+	bc->encoding = "codabar";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
-    /* the partial code is 8 * (head + text + check + tail) + margin + term. */
-    partial = malloc( (strlen(text) + 3) * 8 + 2);
-    if (!partial) {
-        bc->error = errno;
+    if (!(len = strlen(text)))
+        return Barcode_text_error(bc, 0);
+    /* the runs are 8 * (head + text + check + tail) + margin. */
+    if (Barcode_alloc_runs(bc, (len + 3) * 8 + 1) < 0)
         return -1;
-    }
 
-    /* the text information is at most "nnn:fff:c " * (strlen + check) +term */
-    textinfo = malloc(10*(strlen(text) + 1) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
+    /* one glyph per char */
+    if (Barcode_alloc_glyphs(bc, len) < 0)
         return -1;
-    }
 
-    ptr = partial;
-    textptr = textinfo;
     textpos = 0;
     usesum = bc->flags & BARCODE_NO_CHECKSUM ? 0 : 1;
     /* if no start character specified, A is used as a start character */
     if (!isalpha(text[0])) {
-	add_one(ptr, CODE_A);
-	ptr += strlen(ptr);
+	add_one(bc, CODE_A);
 	textpos = WIDE;
 	checksum = CODE_A;
 	startpresent = 0;
     } else {
 	startpresent = 1;
     }
-    for (i=0; i<strlen(text); i++) {
+    for (i=0; i<len; i++) {
+        /* no mixed case: all lowercase is accepted, though */
+        if (isupper(text[i])) upper++;
+        if (islower(text[i])) lower++;
         c = strchr(alphabet, toupper(text[i]));
-        if (!c) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            return -1;
-        }
+        if (!c || (lower && upper))
+            return Barcode_text_error(bc, i);
         code = c - alphabet;
-        add_one(ptr, code);
-        sprintf(textptr, "%i:12:%c ", textpos, toupper(text[i]));
+        /* a letter is the start char, or the stop char if there's one */
+        if (code >= CODE_A && i && (!startpresent || i != len - 1))
+            return Barcode_text_error(bc, i);
+        add_one(bc, code);
+        Barcode_add_glyph(bc, textpos, 12, toupper(text[i]), 0);
         textpos += code < 12 ? NARROW : WIDE;
-        textptr += strlen(textptr);
-        ptr += strlen(ptr); 
 	checksum += code;
-	if (startpresent && usesum && i == strlen(text) - 2) {
+	if (startpresent && usesum && i == len - 2) {
 	    /* stuff a check symbol before the stop */
 	    c = strchr(alphabet, toupper(text[i+1]));
 	    if (!c) /* impossible */
@@ -160,8 +129,7 @@ int Barcode_cbr_encode(struct Barcode_Item *bc)
 
 	    /* Complement to a multiple of 16 */
 	    checksum = (checksum + 15) / 16 * 16 - checksum;
-	    add_one(ptr, checksum);
-	    ptr += strlen(ptr);
+	    add_one(bc, checksum);
 	}
     }
     if (!startpresent) {
@@ -169,13 +137,10 @@ int Barcode_cbr_encode(struct Barcode_Item *bc)
 	    /* if no start character specified, B is used as a stop char */
 	    checksum += CODE_B;
 	    checksum = (checksum + 15) / 16 * 16 - checksum;
-	    add_one(ptr, checksum);
-	    ptr += strlen(ptr);
+	    add_one(bc, checksum);
 	}
-	add_one(ptr, CODE_B);
+	add_one(bc, CODE_B);
     }
-    bc->partial = partial;
-    bc->textinfo = textinfo;
 
     return 0;
 }
@@ -43,51 +43,34 @@ static char *codeset[] =  {
 #define START_STOP 11
 #define HYPHEN       45    
 
+/* the verify function checks the text by encoding it */
+int Barcode_11_encode(struct Barcode_Item *bc);
+
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  */
 
 
-int Barcode_11_verify(unsigned char *text)
+int Barcode_11_verify(char *text)
 {
-    int i;
-    char *chr = NULL;
-
-    if (text[0] == '\0')
-        return -1;
-    
-    for (i = 0; text[i]; i++) 
-        if ((chr = strchr(alphabet, text[i])) == NULL) 
-            return -1;
-    
-    return 0;
+    return Barcode_verify_text(text, Barcode_11_encode);
 }
 
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
+ * The encoding functions fills the "runs" and "glyphs" fields.
  */
 
 int Barcode_11_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *c = NULL, *textptr = NULL;
+    char *text;
+    char *c = NULL;
     int i, code, textpos, len = 0;
     int weight = 0;
     int c_checksum = 0, k_checksum = 0;
     
-    if (bc->partial)
-        free(bc->partial);
-    
-    if (bc->textinfo)
-        free(bc->textinfo);
-    
-    bc->partial = bc->textinfo = NULL; /* safe */
-
     if ((bc->encoding == NULL))
-        bc->encoding = strdup("code 11");
+        bc->encoding = "code 11";
 
     if ((text = bc->ascii) == NULL) {
         bc->error = EINVAL;
@@ -95,52 +78,35 @@ int Barcode_11_encode(struct Barcode_Item *bc)
         return -1;
     }
     
-    if ((len = strlen(text)) == 0) {
-         bc->error = EINVAL;
-        
-        return -1;
-    }
+    if ((len = strlen(text)) == 0)
+        return Barcode_text_error(bc, 0);
 
     /* allocate space for 2 start-stop symbol and C checksum      
      * we need extra space for K checksum when len >= 10 */
     
-    if ((partial = (char *)calloc(1, (len >= 10) ? ((len + 4) * 7) + 1 :
-            ((len + 3) * 7) + 1)) == NULL) { 
-        bc->error = errno;
-        
+    if (Barcode_alloc_runs(bc, (len >= 10) ? ((len + 4) * 7) + 1 :
+            ((len + 3) * 7) + 1) < 0)
         return -1;
-    }
 
-    if ((textinfo = (char *)calloc(1, 10 * (len + 2))) == NULL) {
-        bc->error = errno;
-        free(partial);
-    
+    if (Barcode_alloc_glyphs(bc, len) < 0)
         return -1;
-    }
     
-    strcpy(partial, "0"); /*  no-extra-space-needed - see ps.c */
+    Barcode_add_runs(bc, "0", 0); /*  no-extra-space-needed - see ps.c */
     
-    strcat(partial, codeset[START_STOP]);
+    Barcode_add_runs(bc, codeset[START_STOP], 0);
     
-    textptr = textinfo;
     textpos = 7;
     
     for (i = 0; text[i]; i++) {
-        if ((c = strchr(alphabet, text[i])) == NULL) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-    
-            return -1;
-        }
+        if ((c = strchr(alphabet, text[i])) == NULL)
+            return Barcode_text_error(bc, i);
     
         code = c - alphabet;
-        strcat(partial, codeset[code]);
+        Barcode_add_runs(bc, codeset[code], 0);
            
-        sprintf(textptr, "%i:7:%c ", textpos, text[i]);
+        Barcode_add_glyph(bc, textpos, 7, text[i], 0);
                   
         textpos += 7; /* width of each code */
-        textptr += strlen(textptr);
     }
     
     /* Add the checksum */
@@ -160,7 +126,7 @@ int Barcode_11_encode(struct Barcode_Item *bc)
                 c_checksum += ((text[len - i] - 48) * weight);
         }
     
-        strcat(partial, codeset[c_checksum % 11]);
+        Barcode_add_runs(bc, codeset[c_checksum % 11], 0);
     
         
         if (len >= 10 ) { /* Add K checksum */
@@ -182,16 +148,13 @@ int Barcode_11_encode(struct Barcode_Item *bc)
             /* add c_checksum to K - it's the last character so its weight is 1 */
             k_checksum += (c_checksum % 11);
 
-            strcat(partial, codeset[k_checksum % 9]);
+            Barcode_add_runs(bc, codeset[k_checksum % 9], 0);
         }
     }
     
     /* end */
     
-    strcat(partial, codeset[START_STOP]);
-
-    bc->partial = partial;
-    bc->textinfo = textinfo;
+    Barcode_add_runs(bc, codeset[START_STOP], 0);
 
     return 0;
 }
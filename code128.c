@@ -68,89 +68,81 @@ static char *codeset[] = {
 
 #define SYMBOL_WID 11 /* all of them are 11-bar wide */
 
+/* the verify functions check the text by encoding it */
+int Barcode_128b_encode(struct Barcode_Item *bc);
+int Barcode_128c_encode(struct Barcode_Item *bc);
+int Barcode_128_encode(struct Barcode_Item *bc);
+int Barcode_128raw_encode(struct Barcode_Item *bc);
+
 /*
  * code 128-b includes all printable ascii chars
  */
 
 int Barcode_128b_verify(char *text)
 {
-    if (text[0] == '\0')
-	return -1;
-    while (*text && *text>=32 && !(*text&0x80))
-	text++;
-    if (*text)
-	return -1; /* a non-ascii char */
-    return 0; /* ok */
+    return Barcode_verify_text(text, Barcode_128b_encode);
 }
 
 int Barcode_128b_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *textptr;
-    int i, code, textpos, checksum = 0;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    char *text;
+    int i, len, code, textpos, checksum = 0;
+    struct Barcode_Checkpoint *cp;
 
     if (!bc->encoding)
-	bc->encoding = strdup("code 128-B");
+	bc->encoding = "code 128-B";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
-    /* the partial code is 6* (head + text + check + tail) + final + term. */
-    partial = malloc( (strlen(text) + 4) * 6 +2);
-    if (!partial) {
-        bc->error = errno;
-        return -1;
-    }
-
-    /* the text information is at most "nnn:fff:c " * strlen +term */
-    textinfo = malloc(10*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
+    if (!text[0])
+        return Barcode_text_error(bc, 0);
+    /*
+     * the runs are 6* (head + text + check + tail) + final + first,
+     * with one glyph per char; go on from the previous text if it is
+     * the same
+     */
+    len = strlen(text);
+    i = Barcode_resume(bc, BARCODE_128B, text, len, (len + 4) * 6 + 2, len,
+		       &cp);
+    if (i < 0)
         return -1;
-    }
 
     /* up to now, it was the same code as other encodings */
 
-    strcpy(partial, "0"); /* the first space */
-    strcat(partial, codeset[START_B]);
-    checksum += START_B; /* the start char is counted in the checksum */
-    textptr = textinfo;
-    textpos = SYMBOL_WID;
+    if (cp) {
+	checksum = cp->sum;
+	textpos = cp->pos;
+    } else {
+	Barcode_add_runs(bc, "0", 0); /* the first space */
+	Barcode_add_runs(bc, codeset[START_B], 0);
+	checksum += START_B; /* the start char is counted in the checksum */
+	textpos = SYMBOL_WID;
+    }
 
-    for (i=0; i<strlen(text); i++) {
-        if ( text[i] < 32 || (text[i] & 0x80)) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            return -1;
-        }
+    for (; text[i]; i++) {
+	if ((cp = Barcode_checkpoint(bc, i))) {
+	    cp->sum = checksum;
+	    cp->pos = textpos;
+	}
+        if ( text[i] < 32 || (text[i] & 0x80))
+            return Barcode_text_error(bc, i); /* a non-ascii char */
 	code = text[i]-32;
-	strcat(partial, codeset[code]);
-	checksum += code * (i+1); /* first * 1 + second * 2 + third * 3... */
-        sprintf(textptr, "%i:12:%c ", textpos, text[i]);
-        textptr += strlen(textptr);
+	Barcode_add_runs(bc, codeset[code], 0);
+	/* first * 1 + second * 2 + third * 3..., kept small for long texts */
+	checksum = (checksum + code * ((i + 1) % 103)) % 103;
+        Barcode_add_glyph(bc, textpos, 12, text[i], 0);
         textpos += SYMBOL_WID; /* width of each code */
     }
     /* Add the checksum, independent of BARCODE_NO_CHECKSUM */
     checksum %= 103;
-    strcat(partial, codeset[checksum]);
+    Barcode_add_runs(bc, codeset[checksum], 0);
     /* and the end marker */
-    strcat(partial, codeset[STOP]);
-
-    bc->partial = partial;
-    bc->textinfo = textinfo;
+    Barcode_add_runs(bc, codeset[STOP], 0);
 
+    Barcode_resume_end(bc, text, len);
     return 0;
 }
 
@@ -160,87 +152,74 @@ int Barcode_128b_encode(struct Barcode_Item *bc)
 
 int Barcode_128c_verify(char *text)
 {
-    if (text[0] == '\0')
-	return -1;
-    /* must be an even number of digits */
-    if (strlen(text)%2)
-	return -1;
-    /* and must be all digits */
-    for (; *text; text++)
-	if (!isdigit(*text))
-	    return -1;
-    return 0;
+    return Barcode_verify_text(text, Barcode_128c_encode);
 }
 
 int Barcode_128c_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *textptr;
-    int i, code, textpos, checksum = 0;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    char *text;
+    int i, len, code, textpos, checksum = 0;
+    struct Barcode_Checkpoint *cp;
 
     if (!bc->encoding)
-	bc->encoding = strdup("code 128-C");
+	bc->encoding = "code 128-C";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
-    /* the partial code is 6* (head + text + check + tail) + final + term. */
-    partial = malloc( (strlen(text) + 3) * 6 +2);
-    if (!partial) {
-        bc->error = errno;
+    /* must be an even number of digits: one more is needed */
+    len = strlen(text);
+    if (!len || len%2)
+        return Barcode_text_error(bc, len);
+    /*
+     * the runs are 6* (head + text + check + tail) + final + first,
+     * with one glyph per digit; go on from the previous text if it is
+     * the same (the checkpoints are at the even digits)
+     */
+    i = Barcode_resume(bc, BARCODE_128C, text, len, (len + 3) * 6 + 2, len,
+		       &cp);
+    if (i < 0)
         return -1;
-    }
 
-    /* the text information is at most "nnn.5:fff:c " * strlen +term */
-    textinfo = malloc(12*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
-        return -1;
+    if (cp) {
+	checksum = cp->sum;
+	textpos = cp->pos;
+    } else {
+	Barcode_add_runs(bc, "0", 0); /* the first space */
+	Barcode_add_runs(bc, codeset[START_C], 0);
+	checksum += START_C; /* the start char is counted in the checksum */
+	textpos = SYMBOL_WID;
     }
 
-    strcpy(partial, "0"); /* the first space */
-    strcat(partial, codeset[START_C]);
-    checksum += START_C; /* the start char is counted in the checksum */
-    textptr = textinfo;
-    textpos = SYMBOL_WID;
-
-    for (i=0; text[i]; i+=2) {
-        if (!isdigit(text[i]) || !isdigit(text[i+1])) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            return -1;
-        }
+    for (; text[i]; i+=2) {
+	if ((cp = Barcode_checkpoint(bc, i))) {
+	    cp->sum = checksum;
+	    cp->pos = textpos;
+	}
+        /* and must be all digits */
+        if (!isdigit(text[i]))
+            return Barcode_text_error(bc, i);
+        if (!isdigit(text[i+1]))
+            return Barcode_text_error(bc, i+1);
         code = (text[i]-'0') * 10 + text[i+1]-'0';
-	strcat(partial, codeset[code]);
-	checksum += code * (i/2+1); /* first * 1 + second * 2 + third * 3... */
+	Barcode_add_runs(bc, codeset[code], 0);
+	/* first * 1 + second * 2 + third * 3..., kept small for long texts */
+	checksum = (checksum + code * ((i/2 + 1) % 103)) % 103;
 
-	/* print as "%s", because we have ".5" positions */
-        sprintf(textptr, "%g:9:%c %g:9:%c ", (double)textpos, text[i],
-		textpos + (double)SYMBOL_WID/2,	text[i+1]);
-        textptr += strlen(textptr);
+	/* two digits per symbol, so we have ".5" positions */
+        Barcode_add_glyph(bc, textpos, 9, text[i], 0);
+        Barcode_add_glyph(bc, textpos + (double)SYMBOL_WID/2, 9, text[i+1], 0);
         textpos += SYMBOL_WID; /* width of each code */
     }
     /* Add the checksum, independent of BARCODE_NO_CHECKSUM */
     checksum %= 103;
-    strcat(partial, codeset[checksum]);
+    Barcode_add_runs(bc, codeset[checksum], 0);
     /* and the end marker */
-    strcat(partial, codeset[STOP]);
-
-    bc->partial = partial;
-    bc->textinfo = textinfo;
+    Barcode_add_runs(bc, codeset[STOP], 0);
 
+    Barcode_resume_end(bc, text, len);
     return 0;
 }
 
@@ -251,22 +230,19 @@ int Barcode_128c_encode(struct Barcode_Item *bc)
  * Char '\0' is expressed by 0x80 (0200).
  */
 
-int Barcode_128_verify(unsigned char *text)
+#define CAN_ENCODE(c) ((c)<=0x80 || ((c) >= 0xc1 && (c) <= 0xc4))
+
+int Barcode_128_verify(char *text)
 {
-    if (text[0] == '\0')
-	return -1;
-    while (*text && (*text<=0x80 || (*text >= 0xc1 && *text <= 0xc4)))
-	text++;
-    if (*text)
-	return -1; /* unencodable character */
-    return 0; /* ok */
+    return Barcode_verify_text(text, Barcode_128_encode);
 }
 
 
 /*
  * These functions are extracted from Barcode_128_encode for clarity.
  * It deals with choosing the symbols used to represent the text
- * and returns a dynamic array of integers, terminated by -1.
+ * and returns a dynamic array of them (the checksum and the end
+ * marker are added by the caller), storing its length in *lptr.
  *
  * The algorithm used in choosing the codes comes from App 2 of
  * "El Codigo Estandar EAN/UCC 128", courtesy of AECOC, Spain.
@@ -277,7 +253,7 @@ int Barcode_128_verify(unsigned char *text)
 #define NEED_CODE_A(c) ((c)<32 || (c)==0x80) 
 #define NEED_CODE_B(c) ((c)>=96 && (c)<128)
 
-static int Barcode_a_or_b(char *text)
+static int Barcode_a_or_b(unsigned char *text)
 {
     for ( ; *text; text++) {
 	if (NEED_CODE_A(*text))
@@ -311,19 +287,30 @@ static int Barcode_encode_as(int code, int value)
     return -1;
 }
 
-static int *Barcode_128_make_array(struct Barcode_Item *bc, int *lptr)
+static unsigned char *Barcode_128_make_array(struct Barcode_Item *bc,
+					     int *lptr)
 {
-    int len, *codes;
-    char *s;
-    int i=0, j, code, checksum;
+    int len;
+    unsigned char *codes; /* all symbols are less than 107 */
+    unsigned char *s; /* F1-F4 are above 0x80 */
+    int i=0, j, code;
 
     /* allocate twice the text length + 5, as this is the worst case */
     len = 2 * strlen(bc->ascii) + 5;
-    codes = malloc(len * sizeof(int));
-    s = bc->ascii;
+    codes = Barcode_malloc(bc, len);
+    if (!codes) {
+	bc->error = errno;
+	return NULL;
+    }
+    s = (unsigned char *)bc->ascii;
+    if (!s[0]) {
+	Barcode_free(bc, codes);
+	Barcode_text_error(bc, 0);
+	return NULL;
+    }
 
     /* choose the starting code */
-    if (s[2]=='\0' && isdigit(s[0]) && isdigit(s[1])) {
+    if (isdigit(s[0]) && isdigit(s[1]) && s[2]=='\0') {
       code = 'C';
     } else if (isdigit(s[0])&&isdigit(s[1]) && isdigit(s[2])&&isdigit(s[3])) {
 	code = 'C';
@@ -333,7 +320,13 @@ static int *Barcode_128_make_array(struct Barcode_Item *bc, int *lptr)
     }
     codes[i++] = START_A + code - 'A';
     
-    for (s = bc->ascii; *s; /* increments are in the loop */) {
+    for (s = (unsigned char *)bc->ascii; *s; /* increments are in the loop */) {
+	/* all the chars go through here, but the second digit of a pair */
+	if (!CAN_ENCODE(*s)) {
+	    Barcode_free(bc, codes);
+	    Barcode_text_error(bc, (char *)s - bc->ascii); /* unencodable character */
+	    return NULL;
+	}
 	switch(code) {
 
 	    case 'C':
@@ -392,20 +385,122 @@ static int *Barcode_128_make_array(struct Barcode_Item *bc, int *lptr)
 		break;
 	}	    
     }
-    /* add the checksum */
-    checksum = codes[0];
-    for (j=1; j<i; j++)
-	checksum += j * codes[j];
-    checksum %= 103;
-    codes[i++] = checksum;
-    codes[i++] = STOP;
-    if (i > len) {
+    /* leave room for the checksum and the end marker */
+    if (i + 2 > len) {
 	fprintf(stderr, "impossible: length is > allocated len\n");
     }
     *lptr = i;
     return codes;
 }
 
+/*
+ * With BARCODE_SHORTEST the symbols are chosen to be as few as
+ * possible. cost[3*i + set] is how many symbols the chars from "i" on
+ * need, starting in set A, B or C (0, 1, 2): a char (or a pair of
+ * digits, or F1 in C) is encoded in the set, maybe after a SHIFT, or
+ * the set is changed first. Changing twice in a row never pays, so
+ * one pass from the end of the text is enough; "to" remembers the
+ * change, or 3 if the char is encoded in the set itself
+ */
+#define NO_SET  3
+#define NEVER   (1 << 28)
+
+static int code128_change[3][3] = {
+    {0,      CODE_B, CODE_C},
+    {CODE_A, 0,      CODE_C},
+    {CODE_A, CODE_B, 0}
+};
+
+static unsigned char *Barcode_128_shortest_array(struct Barcode_Item *bc,
+						 int *lptr)
+{
+    unsigned char *s = (unsigned char *)bc->ascii;
+    unsigned char *codes, *to;
+    int *cost, stay[3];
+    int n, i, j, set, c;
+
+    n = strlen(bc->ascii);
+    if (!n) {
+	Barcode_text_error(bc, 0);
+	return NULL;
+    }
+    for (i = 0; i < n; i++)
+	if (!CAN_ENCODE(s[i])) {
+	    Barcode_text_error(bc, i); /* unencodable character */
+	    return NULL;
+	}
+
+    /* the worst case is the same as above */
+    codes = Barcode_malloc(bc, 2 * n + 5);
+    cost = Barcode_malloc(bc, 3 * (n + 1) * sizeof(*cost));
+    to = Barcode_malloc(bc, 3 * n);
+    if (!codes || !cost || !to) {
+	bc->error = errno;
+	Barcode_free(bc, codes);
+	Barcode_free(bc, cost);
+	Barcode_free(bc, to);
+	return NULL;
+    }
+
+    for (set = 0; set < 3; set++)
+	cost[3 * n + set] = 0;
+    for (i = n - 1; i >= 0; i--) {
+	c = s[i];
+	stay[0] = cost[3 * (i + 1)] + (NEED_CODE_B(c) ? 2 : 1);
+	stay[1] = cost[3 * (i + 1) + 1] + (NEED_CODE_A(c) ? 2 : 1);
+	if (isdigit(c) && isdigit(s[i + 1]))
+	    stay[2] = cost[3 * (i + 2) + 2] + 1;
+	else if (c == 0xC1)
+	    stay[2] = cost[3 * (i + 1) + 2] + 1;
+	else
+	    stay[2] = NEVER;
+	for (set = 0; set < 3; set++) {
+	    cost[3 * i + set] = stay[set];
+	    to[3 * i + set] = NO_SET;
+	    for (j = 0; j < 3; j++)
+		if (j != set && stay[j] + 1 < cost[3 * i + set]) {
+		    cost[3 * i + set] = stay[j] + 1;
+		    to[3 * i + set] = j;
+		}
+	}
+    }
+
+    /* start in the cheapest set, B or C rather than A if they tie */
+    set = 1;
+    if (cost[2] < cost[set])
+	set = 2;
+    if (cost[0] < cost[set])
+	set = 0;
+    codes[0] = START_A + set;
+    for (i = 0, j = 1; i < n; ) {
+	if (to[3 * i + set] != NO_SET) {
+	    codes[j++] = code128_change[set][to[3 * i + set]];
+	    set = to[3 * i + set];
+	}
+	c = s[i];
+	if (set == 2) {
+	    if (c == 0xC1) {
+		codes[j++] = FUNC_1;
+		i++;
+	    } else {
+		codes[j++] = (s[i] - '0') * 10 + s[i + 1] - '0';
+		i += 2;
+	    }
+	} else if (set == 0 ? NEED_CODE_B(c) : NEED_CODE_A(c)) {
+	    codes[j++] = SHIFT;
+	    codes[j++] = Barcode_encode_as(set ? 'A' : 'B', c);
+	    i++;
+	} else {
+	    codes[j++] = Barcode_encode_as('A' + set, c);
+	    i++;
+	}
+    }
+    Barcode_free(bc, cost);
+    Barcode_free(bc, to);
+    *lptr = j;
+    return codes;
+}
+
 /*
  * Encoding is tricky, in that we cannot print the ascii
  * representation in an easy way. Therefore, just skip non-printable
@@ -413,22 +508,14 @@ static int *Barcode_128_make_array(struct Barcode_Item *bc, int *lptr)
  */
 int Barcode_128_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *textptr;
-    int *codes; /* dynamic */
-    int i, c, len;
+    char *text;
+    unsigned char *codes; /* dynamic */
+    int i, c, len, checksum;
     double textpos, size, step;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    struct Barcode_Checkpoint *cp;
 
     if (!bc->encoding)
-	bc->encoding = strdup("code 128");
+	bc->encoding = "code 128";
 
     text = bc->ascii;
     if (!text) {
@@ -436,36 +523,52 @@ int Barcode_128_encode(struct Barcode_Item *bc)
         return -1;
     }
 
-    codes = Barcode_128_make_array(bc, &len);
+    if (bc->flags & BARCODE_SHORTEST)
+	codes = Barcode_128_shortest_array(bc, &len);
+    else
+	codes = Barcode_128_make_array(bc, &len);
     if (!codes) return -1;
 
-    /* the partial code is 6*codelen + ini + term (+margin) */
-    partial = malloc( 6 * len + 4);
-    if (!partial) {
-        bc->error = errno;
-	free(codes);
-        return -1;
-    }
-
-    /* the text information is at most "nnn.n:ff.f:c " * strlen +term */
-    textptr = textinfo = malloc(13*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
-	free(codes);
+    /*
+     * the runs are 6*codelen + ini + term (+margin), with one glyph per
+     * char. The choice of a symbol depends on the chars that follow,
+     * so the symbols are compared with the previous ones, not the text:
+     * the runs of the same ones are kept, with the checksum so far
+     */
+    i = Barcode_resume(bc, BARCODE_128, (char *)codes, len, 6 * (len + 2) + 4,
+		       strlen(text), &cp);
+    if (i < 0) {
+	Barcode_free(bc, codes);
         return -1;
     }
 
     /* up to now, it was almost the same code as other encodings */
 
-    strcpy(partial, "0"); /* the first space */
-    for (i=0; i<len; i++) /* the symbols */
-	strcat(partial, codeset[codes[i]]);
+    if (cp) {
+	checksum = cp->sum;
+	c = bc->nruns;
+    } else {
+	Barcode_add_runs(bc, "0", 0); /* the first space */
+	checksum = 0;
+	c = 0;
+    }
+    for (; i<len; i++) { /* the symbols */
+	if ((cp = Barcode_checkpoint(bc, i)))
+	    cp->sum = checksum;
+	/* start * 1 + first * 1 + second * 2..., kept small for long texts */
+	checksum = (checksum + (i ? i % 103 : 1) * codes[i]) % 103;
+	Barcode_add_runs(bc, codeset[codes[i]], 0);
+    }
+    Barcode_add_runs(bc, codeset[checksum % 103], 0);
+    Barcode_add_runs(bc, codeset[STOP], 0);
+    len += 2;
 
     /* avoid bars that fall lower than other bars */
-    for (i=0; partial[i]; i++)
-	if (isalpha(partial[i]))
-	    partial[i] += '1' - 'a';
+    for (i=c; i<bc->nruns; i++)
+	bc->runflags[i] &= ~BARCODE_RUN_LONG;
+
+    /* the glyphs depend on the length: they are all placed again */
+    bc->nglyphs = 0;
 
     /*
      * the accompanying text: reserve a space for every char.
@@ -484,18 +587,16 @@ int Barcode_128_encode(struct Barcode_Item *bc)
     step = (int)(10 * (size/18.0 * SYMBOL_WID) + .5) / 10.0;
     textpos = SYMBOL_WID;
 
-    for (i=0; i<strlen(text); i++) {
-	c = text[i];
+    for (i=0; text[i]; i++) {
+	c = (unsigned char)text[i];
 	if (c < 32 || c == 0x80) c = '_'; /* not printable */
 	if (c > 0xc0) c = ' '; /* F code */
-        sprintf(textptr, "%g:%g:%c ", textpos, size, c);
-        textptr += strlen(textptr);
+        Barcode_add_glyph(bc, textpos, size, c, 0);
         textpos += step;
     }
 
-    bc->partial = partial;
-    bc->textinfo = textinfo;
-    free(codes);
+    Barcode_resume_end(bc, (char *)codes, len - 2);
+    Barcode_free(bc, codes);
     return 0;
 }
 
@@ -504,104 +605,107 @@ int Barcode_128_encode(struct Barcode_Item *bc)
  * from 0 to 105, starting from the start code to be (Leonid)
  */
 
-int Barcode_128raw_verify(char *text)
+/*
+ * The numbers are parsed by hand: move "s" past the next one and the
+ * blank space before it. Returns 1 and the symbol, 0 at the end of the
+ * text, or -1 with "s" where a number from 0 to 105 should begin
+ */
+static int Barcode_128raw_next(char **s, int *code)
 {
+    char *p = *s;
     int n;
-    unsigned val;
 
-    if (!strlen(text))
+    if (!*p)
+	return 0;
+    while (isspace((unsigned char)*p))
+	p++;
+    *s = p;
+    if (!isdigit((unsigned char)*p))
+	return -1; /* blank space at the end is an error too */
+    for (n = 0; isdigit((unsigned char)*p); p++)
+	if ((n = n * 10 + *p - '0') > 105)
+	    n = 106; /* too big anyway, don't overflow */
+    if (n > 105)
+	return -1;
+    *code = n;
+    *s = p;
+    return 1;
+}
+
+/* the number of symbols in the text, or -1 with the wrong position */
+static int Barcode_128raw_count(char *text, int *errpos)
+{
+    char *s = text;
+    int n = 0, code, retval;
+
+    while ((retval = Barcode_128raw_next(&s, &code)) > 0)
+	n++;
+    if (retval < 0 || !n) {
+	*errpos = s - text;
 	return -1;
-    while (*text) {
-	if (sscanf(text, "%u%n", &val, &n) < 1)
-	    return -1;
-	if (val > 105)
-	    return -1;
-	text += n;
     }
-    return 0;
+    return n;
+}
+
+int Barcode_128raw_verify(char *text)
+{
+    int pos;
+
+    /* the symbols are only parsed: nothing is allocated */
+    return Barcode_128raw_count(text, &pos) < 0 ? -1 : 0;
 }
 
 int Barcode_128raw_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *textptr;
-    int i, n, count, code, textpos, checksum = 0;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    char *text, *s;
+    int n, pos, code, count, textpos, checksum = 0;
 
     if (!bc->encoding)
-	bc->encoding = strdup("128raw");
+	bc->encoding = "128raw";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
+    if ((n = Barcode_128raw_count(text, &pos)) < 0)
+        return Barcode_text_error(bc, pos);
     /*
-     * length of partial code is unknown in advance, but it is
-     * at most  6* (1+text/2 + check + tail) + final + terminator
+     * the runs are 6* (text + check) + 7 (tail) + first,
+     * and two glyphs per symbol
      */
-    partial = malloc( (3+ strlen(text)/2) * 6 + 2);
-    if (!partial) {
-        bc->error = errno;
+    if (Barcode_alloc_runs(bc, (n + 1) * 6 + 7 + 1) < 0)
         return -1;
-    }
-
-    /* the text information is at most "nnn.5:fff:c " * 1+strlen/2 +term */
-    textinfo = malloc(12 * (1+strlen(text)/2) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
+    if (Barcode_alloc_glyphs(bc, 2 * n) < 0)
         return -1;
-    }
 
-    strcpy(partial, "0"); /* the first space */
-    textptr = textinfo;
+    Barcode_add_runs(bc, "0", 0); /* the first space */
     textpos = 0;
 
-    for (i=0, count = 0; i < strlen(text); count++) {
-	if (sscanf(text + i, "%u%n", &code, &n) < 1) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            return -1;
-	}
-	strcat(partial, codeset[code]);
+    for (s = text, count = 0; Barcode_128raw_next(&s, &code) > 0; count++) {
+	Barcode_add_runs(bc, codeset[code], 0);
 	
 	/*
 	 * since the start code is part of the "raw" input, it is
 	 * counted in the checksum by itself
 	 */
 	if (!count) checksum += code; /* the start code */
-	else        checksum += code * count; /* first * 1 + second * 2 ... */
+	else        checksum += code * (count % 103); /* first * 1 + ... */
+	checksum %= 103; /* kept small for long texts */
 
 	/*
-	 * print as "%s", because we have ".5" positions
-	 * also, use a size of 9 like codeC above, as each symbol is
-	 * represented by two chars
+	 * we have ".5" positions; also, use a size of 9 like codeC
+	 * above, as each symbol is represented by two chars
 	 */
-        sprintf(textptr, "%g:9:%c %g:9:%c ", (double)textpos, 
-		code >= 100 ? 'A' : code/10 + '0',
-		textpos + (double)SYMBOL_WID/2,	code%10 + '0');
-        textptr += strlen(textptr);
+        Barcode_add_glyph(bc, textpos, 9, code >= 100 ? 'A' : code/10 + '0', 0);
+        Barcode_add_glyph(bc, textpos + (double)SYMBOL_WID/2, 9,
+			  code%10 + '0', 0);
         textpos += SYMBOL_WID; /* width of each code */
-	i += n;
     }
     /* Add the checksum, independent of BARCODE_NO_CHECKSUM */
-    checksum %= 103;
-    strcat(partial, codeset[checksum]);
+    Barcode_add_runs(bc, codeset[checksum], 0);
     /* and the end marker */
-    strcat(partial, codeset[STOP]);
-
-    bc->partial = partial;
-    bc->textinfo = textinfo;
+    Barcode_add_runs(bc, codeset[STOP], 0);
 
     return 0;
 }
-
@@ -74,47 +74,31 @@ static char *code39ext[] = {
     "%P","%Q","%R","%S","%T"
 };
 
+/* the verify functions check the text by encoding it */
+int Barcode_39_encode(struct Barcode_Item *bc);
+int Barcode_39ext_encode(struct Barcode_Item *bc);
+
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  * If it's all lowecase convert to uppercase and accept it
  */
-int Barcode_39_verify(unsigned char *text)
+int Barcode_39_verify(char *text)
 {
-    int i, lower=0, upper=0;
-
-    if (text[0] == '\0')
-	return -1;
-    for (i=0; text[i]; i++) {
-        if (isupper(text[i])) upper++;
-        if (islower(text[i])) lower++;
-        if (!strchr(alphabet,toupper(text[i])))
-            return -1;
-    }
-    if (lower && upper)
-        return -1;
-    return 0;
+    return Barcode_verify_text(text, Barcode_39_encode);
 }
 
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  * Accept all standard ASCII
  */
-int Barcode_39ext_verify(unsigned char *text)
+int Barcode_39ext_verify(char *text)
 {
-    int i;
-
-    if (text[0] == '\0')
-	return -1;
-    for (i=0; text[i]; i++) {
-        if (text[i]>127)
-	    return -1;
-    }
-    return 0;
+    return Barcode_verify_text(text, Barcode_39ext_encode);
 }
 
-static int add_one(char *ptr, int code)
+static int add_one(struct Barcode_Item *bc, int code)
 {
-    char *b, *s;
+    char *b, *s, ptr[12];
 
     if (code < 40) {
         b = bars[code%10];
@@ -123,108 +107,112 @@ static int add_one(char *ptr, int code)
         b = specialbars[code-40];
         s = specialspaces[code-40];
     }
-    sprintf(ptr,"1%c%c%c%c%c%c%c%c%c", /* separator */
-            b[0], s[0], b[1], s[1], b[2], s[2],
-            b[3], s[3], b[4]);
+    /* the separator, then bars and spaces interleaved */
+    ptr[0] = '1';
+    ptr[1] = b[0]; ptr[2] = s[0];
+    ptr[3] = b[1]; ptr[4] = s[1];
+    ptr[5] = b[2]; ptr[6] = s[2];
+    ptr[7] = b[3]; ptr[8] = s[3];
+    ptr[9] = b[4]; ptr[10] = '\0';
+    Barcode_add_runs(bc, ptr, 0);
     return 0;
 }
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
+ * The encoding functions fills the "runs" and "glyphs" fields.
  * Lowercase chars are converted to uppercase
  */
 int Barcode_39_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *c, *ptr, *textptr;
-    int i, code, textpos, checksum = 0;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    char *text;
+    char *c;
+    int i, len, code, textpos, checksum = 0;
+    int lower = 0, upper = 0;
+    struct Barcode_Checkpoint *cp;
 
     if (!bc->encoding)
-	bc->encoding = strdup("code 39");
+	bc->encoding = "code 39";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
-    /* the partial code is 10* (head + text + check + tail) + margin + term. */
-    partial = malloc( (strlen(text) + 3) * 10 +2);
-    if (!partial) {
-        bc->error = errno;
+    if (!text[0])
+        return Barcode_text_error(bc, 0);
+    /*
+     * the runs are 10* (head + text + check + tail) + margin, with one
+     * glyph per char; go on from the previous text if it is the same
+     */
+    len = strlen(text);
+    i = Barcode_resume(bc, BARCODE_39, text, len, (len + 3) * 10 + 1, len,
+		       &cp);
+    if (i < 0)
         return -1;
-    }
 
-    /* the text information is at most "nnn:fff:c " * strlen +term */
-    textinfo = malloc(10*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
-        return -1;
+    if (cp) {
+	checksum = cp->sum;
+	lower = cp->state & 1;
+	upper = cp->state & 2;
+	textpos = cp->pos;
+    } else {
+	Barcode_add_runs(bc, fillers[0], 0);
+	textpos = 22;
     }
 
-    strcpy(partial, fillers[0]);
-    ptr = partial + strlen(partial);
-    textptr = textinfo;
-    textpos = 22;
-
-    for (i=0; text[i]; i++) {
+    for (; text[i]; i++) {
+	if ((cp = Barcode_checkpoint(bc, i))) {
+	    cp->sum = checksum;
+	    cp->state = (lower ? 1 : 0) | (upper ? 2 : 0);
+	    cp->pos = textpos;
+	}
+        /* no mixed case: all lowercase is accepted, though */
+        if (isupper(text[i])) upper++;
+        if (islower(text[i])) lower++;
         c = strchr(alphabet, toupper(text[i]));
-        if (!c) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            return -1;
-        }
+        if (!c || (lower && upper))
+            return Barcode_text_error(bc, i);
         code = c - alphabet;
-        add_one(ptr, code);
+        add_one(bc, code);
         c = strchr(checkbet,*c);
         if (c) /* the '*' is not there */
             checksum += (c-checkbet);
-        sprintf(textptr, "%i:12:%c ", textpos, toupper(text[i]));
+        Barcode_add_glyph(bc, textpos, 12, toupper(text[i]), 0);
         
         textpos += 16; /* width of each code */
-        textptr += strlen(textptr);
-        ptr += strlen(ptr); 
     }
     /* Add the checksum */
     if ( (bc->flags & BARCODE_NO_CHECKSUM)==0 ) {
 	code = (strchr(alphabet, checkbet[checksum % 43]) - alphabet);
-	add_one(ptr, code);
+	add_one(bc, code);
     }
-    strcat(ptr, fillers[1]); /* end */
-    bc->partial = partial;
-    bc->textinfo = textinfo;
+    Barcode_add_runs(bc, fillers[1], 0); /* end */
 
+    Barcode_resume_end(bc, text, len);
     return 0;
 }
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
- * Replace the ascii with extended coding and call 39_encode
+ * The encoding functions fills the "runs" and "glyphs" fields.
+ * Use the extended coding as ascii while calling 39_encode
  */
 int Barcode_39ext_encode(struct Barcode_Item *bc)
 {
-    static char *eascii;
-    static char *text;
-    char c, *ptr;
-    int i;
+    char *eascii;
+    char *text;
+    char c, *ptr, *s;
+    int i, retval;
     
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
+    if (!text[0])
+        return Barcode_text_error(bc, 0);
     
     /* worst case 2 chars per original text */
-    eascii = malloc( strlen(text)*2 +1 );
+    eascii = Barcode_malloc(bc, strlen(text)*2 +1 );
     if (!eascii) {
 	bc->error = errno;
 	return -1;
@@ -235,18 +223,22 @@ int Barcode_39ext_encode(struct Barcode_Item *bc)
     for (i=0; text[i]; i++) {
 	c = text[i];
 	if (c<0) {
-	    bc->error = EINVAL;
-	    free(eascii);
-	    return -1;
+	    Barcode_free(bc, eascii);
+	    return Barcode_text_error(bc, i);
 	}
 	
-	strcpy(ptr, code39ext[(int)c]);
-	ptr += strlen(ptr);
+	for (s = code39ext[(int)c]; *s; )
+	    *ptr++ = *s++;
     }
+    *ptr = '\0';
 
-    /* replace original with encoded version */
+    /*
+     * The ascii belongs to the caller (or to the context): only
+     * replace it for a while, as isbn does
+     */
     bc->ascii = eascii;
-    free(text);
-
-    return Barcode_39_encode(bc);
+    retval = Barcode_39_encode(bc);
+    bc->ascii = text;
+    Barcode_free(bc, eascii);
+    return retval;
 }
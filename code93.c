@@ -61,122 +61,132 @@ static char shiftset2[] =
 #define EXTEND_SLASH   45
 #define EXTEND_PLUS   46
 
+/* the verify function checks the text by encoding it */
+int Barcode_93_encode(struct Barcode_Item *bc);
+
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  * All of ASCII-7 is accepted.
  */
 int Barcode_93_verify(char *text)
 {
-    int i;
+    return Barcode_verify_text(text, Barcode_93_encode);
+}
 
-    if (!strlen(text))
-	return -1;
-    for (i=0; text[i]; i++) {
+/*
+ * The symbols for one char, stored in "codes": returns how many they
+ * are (1 or 2), or 0 if the char can't be encoded
+ */
+int Barcode_93_symbols(int ch, int *codes)
+{
+    char *c;
+    int code;
+
+    /* Test if beyond the range of 7-bit ASCII */
+    if ((unsigned char)ch > 127)
+        return 0;
+    c = strchr(alphabet, ch);
+    if (c) {
+        /* Character is natively supported by the symbology, encode directly */
+        codes[0] = c - alphabet;
+        return 1;
+    }
 
-        /* Test if beyond the range of 7-bit ASCII */
-        if ((int)text[i] > 127)
-            return -1;
+    /* Encode the shift character */
+    switch(shiftset[ch])
+    {
+      case '$':
+        code = EXTEND_DOLLAR;
+        break;
+      case '%':
+        code = EXTEND_PERCENT;
+        break;
+      case '/':
+        code = EXTEND_SLASH;
+        break;
+      case '+':
+        code = EXTEND_PLUS;
+        break;
+      default:
+        code = 0;
+        break;
     }
-    return 0;
+    codes[0] = code;
+
+    /* Encode the second character */
+    codes[1] = strchr(alphabet, shiftset2[ch]) - alphabet;
+    return 2;
 }
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
+ * The encoding functions fills the "runs" and "glyphs" fields.
  * Lowercase chars are converted to uppercase
  */
 int Barcode_93_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *c, *textptr;
+    char *text;
     int *checksum_str;
-    int i, j, k, code, textpos, checksum_len=0;
+    int i, j, k, n, len, textpos, checksum_len=0;
     int c_checksum = 0;
     int k_checksum = 0;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    struct Barcode_Checkpoint *cp;
 
     if (!bc->encoding)
-	bc->encoding = strdup("code 93");
+	bc->encoding = "code 93";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
+    if (!text[0])
+        return Barcode_text_error(bc, 0);
+    len = strlen(text);
 
-    /* length of partial:
-        6 * (head + 2*text + 2*check + tail) + lastbar + margin + terminator */
-    partial = malloc( (strlen(text) *2 + 4) * 6 + 3);
-    if (!partial) {
+    checksum_str = (int *)Barcode_malloc(bc, (len + 3) * 2 * sizeof(int));
+    if (!checksum_str) {
         bc->error = errno;
         return -1;
     }
 
-    checksum_str = (int *)malloc( (strlen(text) + 3) * 2 * sizeof(int));
-    if (!checksum_str) {
-	free(partial);
-        bc->error = errno;
+    /* number of runs:
+        6 * (head + 2*text + 2*check + tail) + lastbar + margin,
+       and one glyph per char; go on from the previous text if it
+       is the same */
+    i = Barcode_resume(bc, BARCODE_93, text, len, (len * 2 + 4) * 6 + 2, len,
+		       &cp);
+    if (i < 0) {
+	Barcode_free(bc, checksum_str);
         return -1;
     }
 
-    /* the text information is at most "nnn:fff:c " * strlen +term */
-    textinfo = malloc(10*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
-	free(checksum_str);
-        return -1;
+    if (cp) {
+	/*
+	 * The check symbols weigh the symbols from the right end, so
+	 * there is no running sum to keep: look them up again, without
+	 * building their runs
+	 */
+	for (j = 0; j < i; j++)
+	    checksum_len += Barcode_93_symbols(text[j],
+					       checksum_str + checksum_len);
+	textpos = cp->pos;
+    } else {
+	textpos = 22;
+	Barcode_add_runs(bc, "0", 0);
+	Barcode_add_runs(bc, codeset[START_STOP], 0);
     }
 
-    textptr = textinfo;
-    textpos = 22;
-    strcpy(partial, "0");
-    strcat(partial, codeset[START_STOP]);
-
-    for (i=0; i<strlen(text); i++) {
-        c = strchr(alphabet, text[i]);
-        if (!c) {
-           /* Encode the shift character */
-	   switch(shiftset[(int)(text[i])])
-           {
-              case '$':
-                 code = EXTEND_DOLLAR;
-                 break;
-              case '%':
-                 code = EXTEND_PERCENT;
-                 break;
-              case '/':
-                 code = EXTEND_SLASH;
-                 break;
-              case '+':
-                 code = EXTEND_PLUS;
-                 break;
-              default:
-                 code = 0;
-                 break;
-           }
-
-           strcat(partial, codeset[code]);
-           checksum_str[checksum_len++] = code;
-
-           /* Encode the second character */
-           code = strchr(alphabet, shiftset2[(int)(text[i])]) - alphabet;
-           strcat(partial, codeset[code]);
-           checksum_str[checksum_len++] = code;
-        } else {
-            /* Character is natively supported by the symbology, encode directly */
-            code = c - alphabet;
-            strcat(partial, codeset[c -alphabet]);
-            checksum_str[checksum_len++] = code;
-        }
-        sprintf(textptr, "%i:12:%c ", textpos, text[i]);
-        textptr += strlen(textptr);
+    for (; text[i]; i++) {
+	if ((cp = Barcode_checkpoint(bc, i)))
+	    cp->pos = textpos;
+	n = Barcode_93_symbols(text[i], checksum_str + checksum_len);
+	if (!n) {
+            Barcode_free(bc, checksum_str);
+            return Barcode_text_error(bc, i);
+	}
+	for (j = 0; j < n; j++)
+	    Barcode_add_runs(bc, codeset[checksum_str[checksum_len++]], 0);
+        Barcode_add_glyph(bc, textpos, 12, text[i], 0);
 	/*
 	 * width of each code is 9; composed codes are 18, but aligning
 	 * the text behind the right bars would be ugly, so use 9 anyways
@@ -203,17 +213,16 @@ int Barcode_93_encode(struct Barcode_Item *bc)
         k_checksum += c_checksum;                           
         k_checksum = k_checksum % 47;
 
-        strcat(partial, codeset[c_checksum]);
-        strcat(partial, codeset[k_checksum]);
+        Barcode_add_runs(bc, codeset[c_checksum], 0);
+        Barcode_add_runs(bc, codeset[k_checksum], 0);
 
     }
-    strcat(partial, codeset[START_STOP]); /* end */
+    Barcode_add_runs(bc, codeset[START_STOP], 0); /* end */
 
     /* Encodes final 1-unit width bar to turn the start character into a stop char */
-    strcat(partial, "1");
-    bc->partial = partial;
-    bc->textinfo = textinfo;
-    free(checksum_str);
+    Barcode_add_runs(bc, "1", 0);
+    Barcode_free(bc, checksum_str);
 
+    Barcode_resume_end(bc, text, len);
     return 0;
 }
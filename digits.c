@@ -0,0 +1,244 @@
+/*
+ * digits.c -- check the check digits: the block path (with SSE2 where
+ * available), the scalar one, Barcode_Check_Chars and the encoders
+ * must all agree
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Usage: "digits [<records>]". For each fixed-length code, random
+ * records are built in a block, most of them with the right check
+ * digit, the others with a wrong one, a stray char (an 'X' too, and
+ * bytes that only look like digits to a signed compare) or random
+ * digits between the records. What Barcode_Check_Chars says of each
+ * record is the reference: Barcode_Check_Block must agree (its last
+ * records, where 16 bytes can't be loaded, take the scalar path), and
+ * so must Barcode_Check_Texts, that checks them one by one.
+ *
+ * Then random texts of every type get their check chars from
+ * Barcode_Check_Chars: the encoders must accept them (and reject a
+ * wrong EAN or UPC check digit), and print the same bars for the
+ * text with its check chars and no checksum as for the text alone
+ */
+
+static unsigned long digits_seed = 1;
+
+static int digits_random(int n)
+{
+    digits_seed = digits_seed * 1103515245 + 12345;
+    return (digits_seed >> 16) % n;
+}
+
+static char *digits_string(char *buf, char *set, int len)
+{
+    int i, n = strlen(set);
+
+    for (i = 0; i < len; i++)
+	buf[i] = set[digits_random(n)];
+    buf[len] = '\0';
+    return buf;
+}
+
+static char dec[] = "0123456789";
+static char stray[] = "X/: x\t\260\271\377"; /* and '0'+128, '9'+128 */
+
+static struct {
+    int type, len;
+} digits_fixed[] = {
+    {BARCODE_EAN,  13},
+    {BARCODE_EAN,   8},
+    {BARCODE_UPC,  12},
+    {BARCODE_ISBN, 13},
+    {BARCODE_ISBN, 10},
+    {0, 0}
+};
+
+/* a record of "len" chars at "rec", and whether it is right */
+static int digits_record(int type, char *rec, int len)
+{
+    char check[3];
+    int i;
+
+    digits_string(rec, dec, len - 1);
+    Barcode_Check_Chars(type, rec, len - 1, check);
+    switch (digits_random(8)) {
+    case 0: case 1: case 2: case 3: /* right */
+	rec[len - 1] = check[0];
+	break;
+    case 4: /* a wrong digit, or an 'X' */
+	rec[len - 1] = "0123456789X"[digits_random(11)];
+	break;
+    case 5: /* a stray char at the end */
+	rec[len - 1] = stray[digits_random(sizeof(stray) - 1)];
+	break;
+    default: /* a stray char before the check digit, that is right */
+	rec[len - 1] = check[0];
+	rec[digits_random(len - 1)] = stray[digits_random(sizeof(stray) - 1)];
+    }
+    for (i = 0; i < len - 1; i++)
+	if (rec[i] < '0' || rec[i] > '9')
+	    return 0;
+    return rec[len - 1] == check[0];
+}
+
+static int digits_block(int type, int len, int n)
+{
+    char *buf, **texts;
+    unsigned char *ref, *ok, *ok2;
+    int i, j, stride, wrong, errors = 0;
+
+    stride = len + digits_random(6); /* with junk between the records */
+    buf = malloc((size_t)n * stride);
+    texts = malloc(n * sizeof(*texts));
+    ref = malloc(n);
+    ok = malloc(n);
+    ok2 = malloc(n);
+    if (!buf || !texts || !ref || !ok || !ok2) {
+	perror("digits");
+	exit(1);
+    }
+    for (i = wrong = 0; i < n; i++) {
+	ref[i] = digits_record(type, buf + i * stride, len);
+	wrong += !ref[i];
+	for (j = len; j < stride; j++) /* that must not be looked at */
+	    buf[i * stride + j] = "0123456789X\n"[digits_random(12)];
+	texts[i] = malloc(len + 1);
+	memcpy(texts[i], buf + i * stride, len);
+	texts[i][len] = '\0';
+    }
+    if (Barcode_Check_Block(type, buf, len, stride, n, ok) != wrong)
+	errors++;
+    if (Barcode_Check_Texts(type, texts, n, ok2) != wrong)
+	errors++;
+    for (i = 0; i < n; i++) {
+	if (ok[i] == ref[i] && ok2[i] == ref[i])
+	    continue;
+	if (errors++ < 10)
+	    fprintf(stderr, "digits: %s \"%s\" (stride %i): %i, block %i, "
+		    "texts %i\n", Barcode_Encoding_Name(type), texts[i],
+		    stride, ref[i], ok[i], ok2[i]);
+    }
+    for (i = 0; i < n; i++)
+	free(texts[i]);
+    free(texts);
+    free(buf);
+    free(ref);
+    free(ok);
+    free(ok2);
+    return errors;
+}
+
+/* whether "text" encodes, and its bars in "partial" (if not NULL) */
+static int digits_encode(char *text, int flags, char *partial, int size)
+{
+    struct Barcode_Item *bc = Barcode_Create(text);
+    int ret;
+
+    ret = bc && Barcode_Encode(bc, flags) == 0;
+    if (ret && partial) {
+	strncpy(partial, Barcode_Partial(bc), size - 1);
+	partial[size - 1] = '\0';
+    }
+    Barcode_Delete(bc);
+    return ret;
+}
+
+static struct {
+    int type;
+    char *chars;
+    int min, max;      /* the length of the texts, without check chars */
+} digits_texts[] = {
+    {BARCODE_EAN,  NULL,  12, 12},
+    {BARCODE_EAN,  NULL,   7,  7},
+    {BARCODE_UPC,  NULL,  11, 11},
+    {BARCODE_UPC,  NULL,   6,  6},
+    {BARCODE_ISBN, NULL,   9,  9},
+    {BARCODE_39,   "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%", 1, 30},
+    {BARCODE_93,   "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%", 1, 30},
+    {BARCODE_11,   "0123456789-", 1, 20},
+    {BARCODE_MSI,  "0123456789", 1, 20},
+    {0, NULL, 0, 0}
+};
+
+static int digits_encoders(int n)
+{
+    char text[64], with[68], *texts[1] = {with}, check[3];
+    char p1[1024], p2[1024];
+    int i, j, k, type, len, errors = 0, bad;
+
+    for (i = 0; digits_texts[i].type; i++) {
+	type = digits_texts[i].type;
+	for (j = 0; j < n; j++) {
+	    len = digits_texts[i].min
+		+ digits_random(digits_texts[i].max - digits_texts[i].min + 1);
+	    digits_string(text, digits_texts[i].chars
+			  ? digits_texts[i].chars : dec, len);
+	    k = Barcode_Check_Chars(type, text, len, check);
+	    sprintf(with, "%s%s", text, check);
+	    bad = k < 0;
+	    if (type == BARCODE_93 && strpbrk(check, "abcd"))
+		continue; /* shift symbols: not chars of the text */
+	    if (!bad && Barcode_Check_Texts(type, texts, 1, NULL) != 0)
+		bad = 1;
+	    switch (type) {
+	    case BARCODE_EAN: case BARCODE_UPC: case BARCODE_ISBN:
+		if (!bad && !digits_encode(with, type, NULL, 0))
+		    bad = 1;
+		/* the ISBN and UPC-E encoders don't check the digit */
+		if (!bad && type != BARCODE_ISBN && len != 6) {
+		    with[len] = '0' + (check[0] - '0' + 1
+				       + digits_random(9)) % 10;
+		    if (digits_encode(with, type, NULL, 0))
+			bad = 1;
+		}
+		break;
+	    default:
+		if (!bad && (!digits_encode(text, type, p1, sizeof(p1))
+			     || !digits_encode(with, type
+					       | BARCODE_NO_CHECKSUM,
+					       p2, sizeof(p2))
+			     || strcmp(p1, p2)))
+		    bad = 1;
+	    }
+	    if (bad && errors++ < 10)
+		fprintf(stderr, "digits: %s \"%s\": check \"%s\" is not "
+			"the encoder's\n", Barcode_Encoding_Name(type), text,
+			k < 0 ? "" : check);
+	}
+    }
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    int i, n = 100000, errors = 0;
+
+    if (argc > 1)
+	n = atoi(argv[1]);
+    for (i = 0; digits_fixed[i].type; i++)
+	errors += digits_block(digits_fixed[i].type, digits_fixed[i].len, n);
+    errors += digits_encoders(n / 50 + 1);
+    printf("%s: %i records and %i texts of each type, %i wrong\n",
+	   argv[0], n, n / 50 + 1, errors);
+    return errors ? 1 : 0;
+}
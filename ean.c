@@ -98,16 +98,11 @@ static char *guardS[] = {"9112","11"};
 /*
  * These functions are shortcuts I use in the encoding engine
  */
-static int ean_make_checksum(char *text, int mode)
+static int ean_make_checksum(char *text, int len, int mode)
 {
-    int esum = 0, osum = 0, i;
+    int esum = 0, osum = 0, i = len;
     int even=1; /* last char is even */
 
-    if (strchr(text, ' '))
-	i = strchr(text, ' ') - text; /* end of first part */
-    else 
-	i = strlen(text); /* end of all */
-
     while (i-- > 0) {
 	if (even) esum += text[i]-'0';
 	else      osum += text[i]-'0';
@@ -123,61 +118,11 @@ static int ean_make_checksum(char *text, int mode)
 }
 
 /*
- * Check that the text can be encoded. Returns 0 or -1.
- * Accept:
- *   13 or 12 digits: EAN-13 w/ or w/o checksum
- * or
- *   8 or 7 digits: EAN-8 w/ or w/o checksum.
- * For both EAN-13 and EAN-8, accept an addon of 2 or 5 digits,
- * separated by ' '
+ * Expand the middle part of UPC-E to UPC-A. The result is written to
+ * the buffer provided by the caller (at least 12 bytes), which is returned
  */
-int Barcode_ean_verify(char *text)
+char *Barcode_upc_e_to_a(char *text, char *result)
 {
-    int i, len0, len, addon;
-    char tmp[24], *spc;
-
-    len = strlen(text);
-    spc = strchr(text, ' ');
-    if (spc) {
-	len0 = spc - text;
-	addon = len - len0 - 1;
-	if (addon != 2 && addon != 5)
-		return -1;
-	for (i=len0+1; i<len; i++)
-	    if (!isdigit(text[i]))
-		return -1;
-    } else
-	len0 = len;
-
-    for (i=0; i<len0; i++)
-        if (!isdigit(text[i]))
-            return -1;
-
-    switch (len0) {
-    case 8:
-	strncpy(tmp, text, 7);
-	tmp[7] = '\0';
-	if (text[7] != (ean_make_checksum(tmp, 0) + '0'))
-		return -1;
-    case 7:
-    	break;
-    case 13:
-	strncpy(tmp, text, 12);
-	tmp[12] = '\0';
-	if (text[12] != (ean_make_checksum(tmp, 0) + '0'))
-		return -1;
-    case 12:
-    	break;
-    default:
-	return -1;
-    }
-    return 0;
-}
-
-/* Expand the middle part of UPC-E to UPC-A */
-static char *upc_e_to_a0(char *text)
-{
-    static char result[16];
     strcpy(result, "00000000000"); /* 11 0's */
 
     switch(text[5]) { /* last char */
@@ -202,7 +147,7 @@ static char *upc_e_to_a0(char *text)
 }
 
 /* Try to expand an UPC-E barcode to its UPC-A equivalent.
- * Accept 6, 7 or 8-digit sequence (not counting the addon):
+ * Accept 6, 7 or 8-digit sequence (the length, without the addon):
  *  6:  only the middle part, encoding "0", w/o checksum.
  *  7:  the middle part, encoding "0" with a correct checksum
  *    or
@@ -210,38 +155,32 @@ static char *upc_e_to_a0(char *text)
  *  8:  fully qualified UPC-E with checksum.
  *
  * Returns a 11 digit UPC-A (w/o checksum) for valid EPC-E barcode
- * or an empty string for an invalid one.
+ * or NULL for an invalid one. The UPC-A string is written to "result",
+ * which must be at least 12 bytes long.
  *
  * The checksum for UPC-E is calculated using its UPC-A equivalent.
  */
-static char *upc_e_to_a(char *text)
+static char *upc_e_to_a(char *text, int len, char *result)
 {
-    static char result[16], *spc;
-    int len, chk;
-
-    spc = strchr(text, ' ');
-    if (spc)
-	len = spc - text;
-    else
-	len = strlen(text);
+    int chk;
 
     switch (len) {
     case 6:
-	strcpy(result, upc_e_to_a0(text));
+	Barcode_upc_e_to_a(text, result);
 	return result;
     case 7:
 	/* the first char is '0' or '1':
 	 * valid number system for UPC-E and no checksum
 	 */
 	if (text[0] == '0' || text[0] == '1') {
-		strcpy(result, upc_e_to_a0(text+1));
+		Barcode_upc_e_to_a(text+1, result);
 		result[0] = text[0];
 		return result;
 	}
 
 	/* Find out whether the 7th char is correct checksum */
-	strcpy(result, upc_e_to_a0(text));
-	chk = ean_make_checksum(result, 0);
+	Barcode_upc_e_to_a(text, result);
+	chk = ean_make_checksum(result, 11, 0);
 
 	if (chk == (text[len-1] - '0'))
 		return result;
@@ -249,9 +188,9 @@ static char *upc_e_to_a(char *text)
 	return NULL;
     case 8:
 	if (text[0] == '0' || text[0] == '1') {
-		strcpy(result, upc_e_to_a0(text+1));
+		Barcode_upc_e_to_a(text+1, result);
 		result[0] = text[0];
-		chk = ean_make_checksum(result, 0);
+		chk = ean_make_checksum(result, 11, 0);
 		if (chk == (text[len-1] - '0'))
 			return result;
 	}
@@ -262,30 +201,16 @@ static char *upc_e_to_a(char *text)
 }
 
 /*
- * Accept a 11 or 12 digit UPC-A barcode and
+ * Accept a 11 digit UPC-A barcode (w/o checksum) and
  * shrink it into an 8-digit UPC-E equivalent if possible.
- * Return NULL if impossible, the UPC-E barcode if possible.
+ * Return NULL if impossible, the UPC-E barcode if possible; the
+ * barcode is written to "result", at least 9 bytes long.
  */
-static char *upc_a_to_e(char *text)
+static char *upc_a_to_e(char *text, char *result)
 {
-    static char	result[16];
-    int		len, chksum;
+    int		chksum;
 
-    len = strlen(text);
-    switch (len) {
-    case 12:
-	strcpy(result, text);
-	result[11] = '\0';
-	chksum = ean_make_checksum(result, 0);
-	if (text[11] != (chksum - '0'))
-		return NULL;
-	break;
-    case 11:
-	chksum = ean_make_checksum(text, 0);
-	break;
-    default:
-	return NULL;
-    }
+    chksum = ean_make_checksum(text, 11, 0);
 
     strcpy(result, "00000000"); /* 8 0's*/
 
@@ -321,54 +246,108 @@ static char *upc_a_to_e(char *text)
 }
 
 /*
- * UPC-A is the same as EAN, but accept
- *    12 or 11 digits (UPC-A w/ or w/o checksum)
- * or accept UPC-E as:
- *    6 digits (w/o number system and checksum): number system '0' assumed,
- *    7 digits (either w/o number system or checksum),
- *    8 digits (w/ number system and checksum)
- * plus the 2 or 5-digit add-on
+ * The text, once checked: what is printed and how. The digits are
+ * the ones actually encoded, the checksum included: the 13 of
+ * EAN-13 (a leading 0 for UPC-A, "978" for ISBN), the 8 of EAN-8 and
+ * UPC-E (the latter rebuilt from the UPC-A equivalent).
  */
-int Barcode_upc_verify(char *text)
+enum ean_kind {UPCA, UPCE, EAN13, EAN8, ISBN};
+
+struct ean_text {
+    enum ean_kind kind;
+    char digits[16];
+    char *addon;       /* the add-on digits in the text, or NULL */
+};
+
+/*
+ * The add-on, if any, is 2 or 5 digits after a blank. Returns the
+ * position of the first char that can't be accepted, or -1
+ */
+static int ean_parse_addon(char *text, int i, int five_only,
+			   struct ean_text *t)
 {
-    int i, len0, len, addon;
-    char tmp[24], *spc;
-
-    len = strlen(text);
-    spc = strchr(text, ' ');
-    if (spc) {
-	len0 = spc - text;
-	addon = len - len0 - 1;
-	if (addon != 2 && addon != 5)
-		return -1;
-	for (i=len0+1; i<len; i++)
-	    if (!isdigit(text[i]))
-		return -1;
-    } else
-	len0 = len;
-
-    for (i=0; i<len0; i++)
-        if (!isdigit(text[i]))
-            return -1;
-
-    switch (len0) {
-    case 6: case 7: case 8:
-	strncpy(tmp, text, len0);
-	tmp[len0] = '\0';
-	if (!upc_e_to_a(tmp))
-		return -1;
-	break;
-    case 12:
-	strncpy(tmp, text, 11);
-	tmp[11] = '\0';
-	if (text[11] != (ean_make_checksum(tmp, 0) + '0'))
-		return -1;
-    case 11:
-    	break;
-    default:
+    int start;
+
+    t->addon = NULL;
+    if (!text[i])
+	return -1;
+    if (text[i] != ' ')
+	return i;
+    start = ++i;
+    while (isdigit(text[i]))
+	i++;
+    if (text[i])
+	return i;
+    if (i - start == 5 || (i - start == 2 && !five_only)) {
+	t->addon = text + start;
 	return -1;
     }
-    return 0;
+    return i - start > 5 ? start + 5 : i;
+}
+
+/*
+ * Check an EAN or UPC text in one pass, filling "t". Accept:
+ *   EAN: 13 or 12 digits: EAN-13 w/ or w/o checksum
+ *     or 8 or 7 digits: EAN-8 w/ or w/o checksum
+ *   UPC: 12 or 11 digits (UPC-A w/ or w/o checksum)
+ *     or 6, 7 or 8 digits for UPC-E (see upc_e_to_a() above)
+ * plus the 2 or 5-digit add-on, separated by ' '.
+ * Returns the position of the first char that can't be accepted
+ * (the check digit if it is wrong), or -1
+ */
+static int ean_parse(char *text, int type, struct ean_text *t)
+{
+    char upca[16];
+    int len0, n, given, pos;
+
+    for (len0 = 0; isdigit(text[len0]); len0++)
+	;
+    if ((pos = ean_parse_addon(text, len0, 0, t)) >= 0)
+	return pos;
+
+    if (type == BARCODE_UPC) {
+	switch (len0) {
+	case 6: case 7: case 8:
+	    if (!upc_e_to_a(text, len0, upca))
+		return len0 == 7 || text[0] == '0' || text[0] == '1'
+		    ? len0 - 1 : 0;
+	    if (!upc_a_to_e(upca, t->digits))
+		return 0; /* can't happen */
+	    t->kind = UPCE;
+	    return -1;
+	case 11: case 12:
+	    t->kind = UPCA;
+	    t->digits[0] = '0'; /* the leading 0 (not printed) */
+	    memcpy(t->digits + 1, text, 11);
+	    n = 12;
+	    break;
+	default:
+	    return len0 > 12 ? 12 : len0;
+	}
+    } else {
+	switch (len0) {
+	case 7: case 8:
+	    t->kind = EAN8;
+	    memcpy(t->digits, text, 7);
+	    n = 7;
+	    break;
+	case 12: case 13:
+	    t->kind = EAN13;
+	    memcpy(t->digits, text, 12);
+	    n = 12;
+	    break;
+	default:
+	    return len0 > 13 ? 13 : len0;
+	}
+    }
+    given = len0 == 8 || len0 == 13 || (t->kind == UPCA && len0 == 12);
+
+    /* add the checksum, or check the one in the text */
+    t->digits[n] = '0' + ean_make_checksum(t->digits, n, 0);
+    t->digits[n + 1] = '\0';
+    if (given && t->digits[n] != text[len0 - 1])
+	return len0 - 1;
+    return -1;
 }
 
 /*
@@ -376,23 +355,24 @@ int Barcode_upc_verify(char *text)
  * check character (if specified) is skipped, the extra 5 digits are
  * accepted after a blank.
  */
-int Barcode_isbn_verify(char *text)
+static int isbn_parse(char *text, struct ean_text *t)
 {
     int i, ndigit=0;
 
+    strcpy(t->digits, "978");
     for (i=0; text[i]; i++) {
 	if (text[i] == '-')
 	    continue;
 	if (isdigit(text[i])) {
-	    ndigit++;
+	    t->digits[3 + ndigit++] = text[i];
 	    if (ndigit == 9) { /* got it all */
 		i++; break;
 	    }
 	    continue;
 	}
-	return -1; /* found non-digit */
+	return i; /* found non-digit */
     }
-    if (ndigit!=9) return -1; /* too short */
+    if (ndigit!=9) return i; /* too short */
 
     /* skip an hyphen, if any */
     if (text[i] == '-')
@@ -400,21 +380,39 @@ int Barcode_isbn_verify(char *text)
     /* accept one more char if any (the checksum) */
     if (isdigit(text[i]) || toupper(text[i])=='X')
 	i++;
-    if (text[i] == '\0')
-	return 0; /* Ok */
 
     /* and accept the extra price tag (blank + 5 digits), if any */
-    if (strlen(text+i) != 6)
-	return -1;
-    if (text[i] != ' ')
-	return -1;
-    i++; /* skip the blank */
-    while (text[i]) {
-	if (!isdigit(text[i]))
-	    return -1;
-	i++;
-    }
-    return 0; /* Ok: isbn + 5-digit addon */
+    if ((i = ean_parse_addon(text, i, 1, t)) >= 0)
+	return i;
+    t->kind = ISBN;
+    t->digits[12] = '0' + ean_make_checksum(t->digits, 12, 0);
+    t->digits[13] = '\0';
+    return -1;
+}
+
+/*
+ * The verify functions: check that the text can be encoded.
+ * Returns 0 or -1.
+ */
+int Barcode_ean_verify(char *text)
+{
+    struct ean_text t;
+
+    return ean_parse(text, BARCODE_EAN, &t) < 0 ? 0 : -1;
+}
+
+int Barcode_upc_verify(char *text)
+{
+    struct ean_text t;
+
+    return ean_parse(text, BARCODE_UPC, &t) < 0 ? 0 : -1;
+}
+
+int Barcode_isbn_verify(char *text)
+{
+    struct ean_text t;
+
+    return isbn_parse(text, &t) < 0 ? 0 : -1;
 }
 
 static int width_of_partial(char *partial)
@@ -430,190 +428,121 @@ static int width_of_partial(char *partial)
     return i;
 }
 
-/*
- * The encoding functions fills the "partial" and "textinfo" fields.
- * This one deals with both upc (-A and -E) and ean (13 and 8).
- */
-int Barcode_ean_encode(struct Barcode_Item *bc)
+static int width_of_runs(struct Barcode_Item *bc)
 {
-    static char text[24];
-    static char partial[256];
-    static char textinfo[256];
-    char *mirror, *ptr1, *ptr2, *tptr = textinfo; /* where text is written */
-    char *spc;
+    int i, wid = 0;
 
-    enum {UPCA, UPCE, EAN13, EAN8, ISBN} encoding = ISBN;
-    int i, xpos, checksum, len, len0, addon;
+    for (i = 0; i < bc->nruns; i++)
+	wid += bc->runs[i];
+    return wid;
+}
 
-    if (!bc->ascii) {
-	bc->error = EINVAL;
-	return -1;
+/* Append the four runs of a digit, possibly mirrored */
+static void add_digit(struct Barcode_Item *bc, int digit, int mirrored,
+		      int flags)
+{
+    char *ptr = digits[digit];
+    char mirror[5];
+
+    if (mirrored) {
+	mirror[0] = ptr[3];
+	mirror[1] = ptr[2];
+	mirror[2] = ptr[1];
+	mirror[3] = ptr[0];
+	mirror[4] = '\0';
+	ptr = mirror;
     }
+    Barcode_add_runs(bc, ptr, flags);
+}
 
-    /* Find out whether the barcode has addon and
-     * the length of the barcode w/o the addon.
-     */
-    len = strlen(bc->ascii);
-    spc = strchr(bc->ascii, ' ');
-    if (spc) {
-	len0 = spc - bc->ascii;
-	addon = strlen(spc + 1);
-	if (addon != 2 && addon != 5) {
-	    bc->error = EINVAL; /* impossible, actually */
-	    return -1;
-	}
-    } else {
-	len0 = len;
-	addon = 0;
-    }
+/*
+ * The encoding functions fills the "runs" and "glyphs" fields.
+ * This one deals with both upc (-A and -E) and ean (13 and 8),
+ * and isbn, once the text has been checked.
+ */
+static int ean_encode(struct Barcode_Item *bc, struct ean_text *t)
+{
+    char *text = t->digits;
+    char *mirror;
+    unsigned char *flags;
+    enum ean_kind encoding = t->kind;
+    int i, xpos, checksum, len;
+    struct Barcode_Checkpoint *cp;
 
     if (!bc->encoding) {
-	/* ISBN already wrote what it is; if unknown, find it out */
-
-	/*
-	 * Do not decide only by barcode length, it may be ambiguous.
-	 * Anyway, either the user specified the barcode type or
-	 * we already found a fitting one.
-	 */
-	switch(bc->flags & BARCODE_ENCODING_MASK) {
-	case BARCODE_EAN:
-		switch (len0) {
-		case 7: case 8:
-			bc->encoding = strdup("EAN-8");
-			encoding = EAN8;
-			break;
-		case 12: case 13:
-			bc->encoding = strdup("EAN-13");
-			encoding = EAN13;
-			break;
-		default:
-			bc->error = -EINVAL;
-			return -1;
-		}
-		break;
-
-	case BARCODE_UPC:
-		switch (len0) {
-		case 6: case 7: case 8:
-			bc->encoding = strdup("UPC-E");
-			encoding = UPCE;
-			break;
-		case 11: case 12:
-			bc->encoding = strdup("UPC-A");
-			encoding = UPCA;
-			break;
-		default:
-			bc->error = -EINVAL;
-			return -1;
-		}
-		break;
-	default:
-		/* else, it's wrong (impossible, as the text is checked) */
-		bc->error = -EINVAL;
-		return -1;
-	}
+	static char *names[] = {"UPC-A", "UPC-E", "EAN-13", "EAN-8", "ISBN"};
+	bc->encoding = names[encoding];
     }
 
-    /* better safe than sorry */
-    if (bc->partial)	free(bc->partial);  bc->partial =  NULL;
-    if (bc->textinfo)	free(bc->textinfo); bc->textinfo = NULL;
-
-    if (encoding == UPCA) { /* add the leading 0 (not printed) */
-	text[0] = '0';
-	strcpy(text+1, bc->ascii);
-    } else if (encoding == UPCE) {
-	strcpy(text, upc_a_to_e(upc_e_to_a(bc->ascii)));
-    } else {
-	strcpy(text, bc->ascii);
-    }
+    /*
+     * 60 runs for EAN-13, 32 for the add-5: be large. And 13 digits
+     * and 5 for the add-on. The add-on is encoded every time, but the
+     * digits go on from those of the previous text, if they are the
+     * same (UPC-E is mirrored according to its last digit: never)
+     */
+    i = Barcode_resume(bc, encoding, text, strlen(text), 128, 18, &cp);
+    if (i < 0)
+	return -1;
 
     /*
-     * build the checksum and the bars: any encoding is slightly different
+     * build the bars: any encoding is slightly different
      */
     if (encoding == UPCA || encoding == EAN13 || encoding == ISBN) {
-	if (!(encoding == UPCA && len0 == 12) &&
-		!(encoding == EAN13 && len0 == 13)) {
-		checksum = ean_make_checksum(text, 0);
-		text[12] = '0' + checksum; /* add it to the text */
-		text[13] = '\0';
+	if (cp) {
+	    xpos = cp->pos;
+	} else {
+	    Barcode_add_runs(bc, guard[0], 0);
+	    if (encoding == EAN13 || encoding == ISBN) { /* The first digit */
+		Barcode_add_glyph(bc, 0, 12, text[0], 0);
+		bc->runs[0] = 9; /* extra space for the digit */
+	    } else if (encoding == UPCA)
+		bc->runs[0] = 9; /* UPC has one digit before the symbol, too */
+	    xpos = width_of_runs(bc);
+	    i = 1;
 	}
-
-	strcpy(partial, guard[0]);
-	if (encoding == EAN13 || encoding == ISBN) { /* The first digit */
-	    sprintf(tptr,"0:12:%c ",text[0]);
-	    tptr += strlen(tptr);
-	    partial[0] = '9'; /* extra space for the digit */
-	} else if (encoding == UPCA)
-	    partial[0] = '9'; /* UPC has one digit before the symbol, too */
-	xpos = width_of_partial(partial);
 	mirror = ean_mirrortab[text[0]-'0'];
 
-	/* left part */
-	for (i=1;i<7;i++) {      
-	    ptr1 = partial + strlen(partial); /* target */
-	    ptr2 =  digits[text[i]-'0'];      /* source */
-	    strcpy(ptr1, ptr2);
-	    if (mirror[i-1] == '1') {
-		/* mirror this */
-		ptr1[0] = ptr2[3];
-		ptr1[1] = ptr2[2];
-		ptr1[2] = ptr2[1];
-		ptr1[3] = ptr2[0];
+	/* left part, then right part */
+	for (;i<13;i++) {
+	    if ((cp = Barcode_checkpoint(bc, i)))
+		cp->pos = xpos;
+	    if (i == 7) {
+		Barcode_add_runs(bc, guard[1], 0); /* middle */
+		xpos += width_of_partial(guard[1]);
 	    }
+	    /* only the left part is mirrored */
+	    add_digit(bc, text[i]-'0', i < 7 && mirror[i-1] == '1', 0);
 	    /*
-	     * Write the ascii digit. UPC has a special case
-	     * for the first digit, which is out of the bars
+	     * Write the ascii digit. UPC has a special case for the
+	     * first and the last digit, which are out of the bars
 	     */
 	    if (encoding == UPCA && i==1) {
-		sprintf(tptr, "0:10:%c ", text[i]);
-		tptr += strlen(tptr);
-		ptr1[1] += 'a'-'1'; /* bars are long */
-		ptr1[3] += 'a'-'1';
+		Barcode_add_glyph(bc, 0, 10, text[i], 0);
+		flags = bc->runflags + bc->nruns - 4;
+		flags[1] |= BARCODE_RUN_LONG; /* bars are long */
+		flags[3] |= BARCODE_RUN_LONG;
+	    } else if (encoding == UPCA && i==12) {
+		Barcode_add_glyph(bc, xpos+13, 10, text[i], 0);
+		flags = bc->runflags + bc->nruns - 4;
+		flags[0] |= BARCODE_RUN_LONG; /* bars are long */
+		flags[2] |= BARCODE_RUN_LONG;
 	    } else {
-		sprintf(tptr, "%i:12:%c ", xpos, text[i]);
-		tptr += strlen(tptr);
+		Barcode_add_glyph(bc, xpos, 12, text[i], 0);
 	    }
-	    /* count the width of the symbol */
-	    xpos += 7; /* width_of_partial(ptr2) */
+	    xpos += 7; /* width_of_partial(digits[...]) */
 	}
-
-	strcat(partial, guard[1]); /* middle */
-	xpos += width_of_partial(guard[1]);
-    
-	/* right part */
-	for (i=7;i<13;i++) {  
-	    ptr1 = partial + strlen(partial); /* target */
-	    ptr2 =  digits[text[i]-'0'];      /* source */
-	    strcpy(ptr1, ptr2);
-	    /*
-	     * Ascii digit. Once again, UPC has a special
-	     * case for the last digit
-	     */
-	    if (encoding == UPCA && i==12) {
-		sprintf(tptr, "%i:10:%c ", xpos+13, text[i]);
-		tptr += strlen(tptr);
-		ptr1[0] += 'a'-'1'; /* bars are long */
-		ptr1[2] += 'a'-'1';
-	    } else {
-		sprintf(tptr, "%i:12:%c ", xpos, text[i]);
-		tptr += strlen(tptr);
-	    }
-	    xpos += 7; /* width_of_partial(ptr2) */
-	}
-	tptr[-1] = '\0'; /* overwrite last space */
-	strcat(partial, guard[2]); /* end */
+	Barcode_add_runs(bc, guard[2], 0); /* end */
 	xpos += width_of_partial(guard[2]);
 
     } else if (encoding == UPCE) {
 	checksum = text[7] - '0';
 
-	strcpy(partial, guardE[0]);
-	partial[0] = '9'; /* UPC-A has one digit before the symbol, too */
-	xpos = width_of_partial(partial);
+	Barcode_add_runs(bc, guardE[0], 0);
+	bc->runs[0] = 9; /* UPC-A has one digit before the symbol, too */
+	xpos = width_of_runs(bc);
 
 	/* UPC-E has the number system written before the bars. */
-	sprintf(tptr, "0:10:%c ", text[0]);
-	tptr += strlen(tptr);
+	Barcode_add_glyph(bc, 0, 10, text[0], 0);
 
 	if (text[0] == '0')
 		mirror = upc_mirrortab[checksum];
@@ -621,154 +550,125 @@ int Barcode_ean_encode(struct Barcode_Item *bc)
 		mirror = upc_mirrortab1[checksum];
 
 	for (i=0;i<6;i++) {      
-	    ptr1 = partial + strlen(partial); /* target */
-	    ptr2 =  digits[text[i+1]-'0'];      /* source */
-	    strcpy(ptr1, ptr2);
-	    if (mirror[i] != '1') { /* negated wrt EAN13 */
-		/* mirror this */
-		ptr1[0] = ptr2[3];
-		ptr1[1] = ptr2[2];
-		ptr1[2] = ptr2[1];
-		ptr1[3] = ptr2[0];
-	    }
-	    sprintf(tptr, "%i:12:%c ", xpos, text[i+1]);
-	    tptr += strlen(tptr);
-	    xpos += 7; /* width_of_partial(ptr2) */
+	    /* mirroring is negated wrt EAN13 */
+	    add_digit(bc, text[i+1]-'0', mirror[i] != '1', 0);
+	    Barcode_add_glyph(bc, xpos, 12, text[i+1], 0);
+	    xpos += 7; /* width_of_partial(digits[...]) */
 	}
 
-	sprintf(tptr, "%i:10:%c ", xpos+10, text[7]);
-	tptr += strlen(tptr);
-	ptr1[0] += 'a'-'1'; /* bars are long */
-	ptr1[2] += 'a'-'1';
+	Barcode_add_glyph(bc, xpos+10, 10, text[7], 0);
+	flags = bc->runflags + bc->nruns - 4;
+	flags[0] |= BARCODE_RUN_LONG; /* bars are long */
+	flags[2] |= BARCODE_RUN_LONG;
 
-	tptr[-1] = '\0'; /* overwrite last space */
-	strcat(partial, guardE[1]); /* end */
+	Barcode_add_runs(bc, guardE[1], 0); /* end */
 
     } else { /* EAN-8  almost identical to EAN-13 but no mirroring */
 
-	if (len0 != 8) {
-	    checksum = ean_make_checksum(text, 0);
-	    text[7] = '0' + checksum; /* add it to the text */
-	    text[8] = '\0';
+	if (cp) {
+	    xpos = cp->pos;
+	} else {
+	    Barcode_add_runs(bc, guard[0], 0);
+	    xpos = width_of_runs(bc);
 	}
 
-	strcpy(partial, guard[0]);
-	xpos = width_of_partial(partial);
-
-	/* left part */
-	for (i=0;i<4;i++) {      
-	    strcpy(partial + strlen(partial), digits[text[i]-'0']);
-	    sprintf(tptr, "%i:12:%c ", xpos, text[i]);
-	    tptr += strlen(tptr);
-	    xpos += 7; /* width_of_partial(digits[text[i]-'0' */
-	}
-	strcat(partial, guard[1]); /* middle */
-	xpos += width_of_partial(guard[1]);
-    
-	/* right part */
-	for (i=4;i<8;i++) {      
-	    strcpy(partial + strlen(partial), digits[text[i]-'0']);
-	    sprintf(tptr, "%i:12:%c ", xpos, text[i]);
-	    tptr += strlen(tptr);
+	/* left part, then right part */
+	for (;i<8;i++) {
+	    if ((cp = Barcode_checkpoint(bc, i)))
+		cp->pos = xpos;
+	    if (i == 4) {
+		Barcode_add_runs(bc, guard[1], 0); /* middle */
+		xpos += width_of_partial(guard[1]);
+	    }
+	    add_digit(bc, text[i]-'0', 0, 0);
+	    Barcode_add_glyph(bc, xpos, 12, text[i], 0);
 	    xpos += 7; /* width_of_partial(digits[text[i]-'0' */
 	}
-	tptr[-1] = '\0'; /* overwrite last space */
-	strcat(partial, guard[2]); /* end */
+	Barcode_add_runs(bc, guard[2], 0); /* end */
     }
 
+    Barcode_resume_end(bc, t->digits, strlen(t->digits));
+
     /*
      * And that's it. Now, in case some add-on is specified it
-     * must be encoded too. Look for it.
+     * must be encoded too. Look for it. Its text goes above the bars.
      */
-    if ( (ptr1 = spc) ) {
-	ptr1++;
-	strcpy(text, ptr1);
-	if (strlen(ptr1)==5) {
-	    checksum = ean_make_checksum(text, 1 /* special way */);
+    if ( (text = t->addon) ) {
+	len = strlen(text);
+	if (len==5) {
+	    checksum = ean_make_checksum(text, 5, 1 /* special way */);
 	    mirror = upc_mirrortab[checksum]+1; /* only last 5 digits */
 	} else {
 	    checksum = atoi(text)%4;
 	    mirror = upc_mirrortab2[checksum];
 	}
-	strcat(textinfo, " +"); strcat(partial, "+");
-	tptr = textinfo + strlen(textinfo);
-	for (i=0; i<strlen(text); i++) {
+	for (i=0; i<len; i++) {
 	    if (!i) {
-		strcat(partial, guardS[0]); /* separation and head */
+		/* separation and head */
+		Barcode_add_runs(bc, guardS[0], BARCODE_RUN_ABOVE);
 		xpos += width_of_partial(guardS[0]);
 	    } else {
-		strcat(partial, guardS[1]);
+		Barcode_add_runs(bc, guardS[1], BARCODE_RUN_ABOVE);
 		xpos += width_of_partial(guardS[1]);
 	    }
-	    ptr1 = partial + strlen(partial); /* target */
-	    ptr2 =  digits[text[i]-'0'];      /* source */
-	    strcpy(ptr1, ptr2);
-	    if (mirror[i] != '1') { /* negated wrt EAN13 */
-		/* mirror this */
-		ptr1[0] = ptr2[3];
-		ptr1[1] = ptr2[2];
-		ptr1[2] = ptr2[1];
-		ptr1[3] = ptr2[0];
-	    }
+	    /* mirroring is negated wrt EAN13 */
+	    add_digit(bc, text[i]-'0', mirror[i] != '1', BARCODE_RUN_ABOVE);
 	    /* and the text */
-	    sprintf(tptr, " %i:12:%c", xpos, text[i]);
-	    tptr += strlen(tptr);
-	    xpos += 7; /* width_of_partial(ptr2) */
+	    Barcode_add_glyph(bc, xpos, 12, text[i], 1);
+	    xpos += 7; /* width_of_partial(digits[...]) */
 	}
     }
 
-    /* all done, copy results to the data structure */
-    bc->partial = strdup(partial);
-    if (!bc->partial) {
-	bc->error = errno;
-	return -1;
-    }
-    bc->textinfo = strdup(textinfo);
-    if (!bc->textinfo) {
-	bc->error = errno;
-	free(bc->partial);
-	bc->partial = NULL;
-	return -1;
-    }
+    /* all done */
     if (!bc->width)
-	bc->width = width_of_partial(partial);
+	bc->width = width_of_runs(bc);
 
     return 0; /* success */
 }
 
+/*
+ * The text is checked while encoding: on failure, bc->errpos tells
+ * which char is wrong
+ */
+static int ean_encode_type(struct Barcode_Item *bc, int type)
+{
+    struct ean_text t;
+    int pos;
+
+    if (!bc->ascii) {
+	bc->error = EINVAL;
+	return -1;
+    }
+    if ((pos = ean_parse(bc->ascii, type, &t)) >= 0)
+	return Barcode_text_error(bc, pos);
+    return ean_encode(bc, &t);
+}
+
+int Barcode_ean_encode(struct Barcode_Item *bc)
+{
+    /* it used to deal with UPC as well, according to the flags */
+    if ((bc->flags & BARCODE_ENCODING_MASK) == BARCODE_UPC)
+	return ean_encode_type(bc, BARCODE_UPC);
+    return ean_encode_type(bc, BARCODE_EAN);
+}
+
 int Barcode_upc_encode(struct Barcode_Item *bc)
 {
-    return Barcode_ean_encode(bc); /* UPC is folded into EAN */
+    return ean_encode_type(bc, BARCODE_UPC); /* UPC is folded into EAN */
 }
 
 int Barcode_isbn_encode(struct Barcode_Item *bc)
 {
-    /* For ISBN we must normalize the string and prefix "978" */
-    char *text = malloc(24); /* 13 + ' ' + 5 plus some slack */
-    char *otext;
-    int i, j, retval;
+    /* For ISBN we normalize the string and prefix "978" */
+    struct ean_text t;
+    int pos;
 
-    if (!text) {
-	bc->error = ENOMEM;
+    if (!bc->ascii) {
+	bc->error = EINVAL;
 	return -1;
     }
-    strcpy(text, "978"); j=3;
-
-    otext = bc->ascii;
-    for (i=0; otext[i]; i++) {
-	if (isdigit(otext[i]))
-	    text[j++] = otext[i];
-	if (j == 12) /* checksum added later */
-	    break;
-    }
-    text[j]='\0';
-    if (strchr(otext, ' '))
-	strcat(text, strchr(otext, ' '));
-    bc->ascii = text;
-    bc->encoding = strdup("ISBN");
-    retval = Barcode_ean_encode(bc);
-    bc->ascii = otext; /* restore ascii for the ps comments */
-    free(text);
-    return retval;
+    if ((pos = isbn_parse(bc->ascii, &t)) >= 0)
+	return Barcode_text_error(bc, pos);
+    bc->encoding = "ISBN";
+    return ean_encode(bc, &t);
 }
-    
@@ -34,33 +34,23 @@ static char *codes[] = {
 
 static char *guard[] = {"a1a1", "c1a"}; /* begin end */
 
-int Barcode_i25_verify(unsigned char *text)
+/* the verify function checks the text by encoding it */
+int Barcode_i25_encode(struct Barcode_Item *bc);
+
+int Barcode_i25_verify(char *text)
 {
-    if (!text[0])
-	return -1;
-    while (*text && isdigit(*text))
-	text++;
-    if (*text)
-	return -1; /* a non-digit char */
-    return 0; /* ok */
+    return Barcode_verify_text(text, Barcode_i25_encode);
 }
 
 int Barcode_i25_encode(struct Barcode_Item *bc)
 {
     char *text;
-    char *partial;  /* dynamic */
-    char *textinfo; /* dynamic */
-    char *textptr, *p1, *p2, *pd;
+    char *p1, *p2, *pd;
+    char pair[12]; /* two interleaved digits */
     int i, len, sum[2], textpos, usesum = 0;
 
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
-
     if (!bc->encoding)
-	bc->encoding = strdup("interleaved 2 of 5");
+	bc->encoding = "interleaved 2 of 5";
 
     text = bc->ascii;
     if (!bc->ascii) {
@@ -70,21 +60,28 @@ int Barcode_i25_encode(struct Barcode_Item *bc)
 
     if ((bc->flags & BARCODE_NO_CHECKSUM)) usesum = 0; else usesum = 1;
 
+    len = strlen(bc->ascii);
+    if (!len)
+	return Barcode_text_error(bc, 0);
+
     /* create the real text string, padded to an even number of digits */
-    text = malloc(strlen(bc->ascii) + 3); /* leading 0, checksum, term. */
+    text = Barcode_malloc(bc, len + 3); /* leading 0, checksum, term. */
     if (!text) {
 	bc->error = errno;
 	return -1;
     }
-    /* add the leading 0 if needed */
-    i = strlen(bc->ascii) + usesum;
-    if (i % 2) {
-	/* add a leading 0 */
-	text[0] = '0';
-	strcpy(text+1, bc->ascii);
-    } else {
-	strcpy(text, bc->ascii);
+    /* add the leading 0 if needed, and check the digits while copying */
+    pd = text;
+    if ((len + usesum) % 2)
+	*(pd++) = '0';
+    for (i=0; i<len; i++) {
+	if (!isdigit(bc->ascii[i])) {
+	    Barcode_free(bc, text);
+	    return Barcode_text_error(bc, i); /* a non-digit char */
+	}
+	*(pd++) = bc->ascii[i];
     }
+    *pd = '\0';
     /* add the trailing checksum if needed, the leading 0 is ignored */
     if (usesum) {
 	sum[0] = sum[1] = 0;
@@ -97,67 +94,52 @@ int Barcode_i25_encode(struct Barcode_Item *bc)
 	 * (e.g., they are in pos. 0..4 or 1..4 of the string)
 	 */
 	i = sum[0] * 3 + sum[1];
-	strcat(text, "0");
-	text[strlen(text)-1] += (10 - (i%10)) % 10;
+	*(pd++) = '0' + (10 - (i%10)) % 10;
+	*pd = '\0';
     }
+    len = pd - text; /* the digits, the checksum too */
 
-    /* the partial code is 5 * (text + check) + 4(head) + 3(tail) + term. */
-    partial = malloc( (strlen(text) + 3) * 5 +2); /* be large... */
-    if (!partial) {
-        bc->error = errno;
-	free(text);
+    /* the runs are 5 * (text + check) + 4(head) + 3(tail) + first. */
+    if (Barcode_alloc_runs(bc, (len + 3) * 5 + 2) < 0) { /* be large... */
+	Barcode_free(bc, text);
         return -1;
     }
 
-    /* the text information is at most "nnn:fff:c " * (strlen+1) +term */
-    textinfo = malloc(10*(strlen(text)+1) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
-	free(text);
+    /* one glyph per digit */
+    if (Barcode_alloc_glyphs(bc, len) < 0) {
+	Barcode_free(bc, text);
         return -1;
     }
 
 
-    strcpy(partial, "0"); /* the first space */
-    strcat(partial, guard[0]); /* start */
+    Barcode_add_runs(bc, "0", 0); /* the first space */
+    Barcode_add_runs(bc, guard[0], 0); /* start */
     textpos = 4; /* width of initial guard */
-    textptr = textinfo;
 
-    len = strlen(text);
     for (i=0; i<len; i+=2) {
-        if (!isdigit(text[i]) || !isdigit(text[i+1])) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            free(text);
-            return -1;
-        }
 	/* interleave two digits */
 	p1 = codes[text[i]-'0'];
 	p2 = codes[text[i+1]-'0'];
-	pd = partial + strlen(partial); /* destination */
+	pd = pair; /* destination */
 	while (*p1) {
 	    *(pd++) = *(p1++);
 	    *(pd++) = *(p2++);
 	}
 	*pd = '\0';
+	Barcode_add_runs(bc, pair, 0);
 	/* and print the ascii text (but don't print the checksum, if any */
-	if (usesum && strlen(text+i)==2) {
+	if (usesum && i == len - 2) {
 	    /* print only one digit, discard the checksum */
-	    sprintf(textptr, "%i:12:%c ", textpos, text[i]);
+	    Barcode_add_glyph(bc, textpos, 12, text[i], 0);
 	} else {
-	    sprintf(textptr, "%i:12:%c %i:12:%c ", textpos, text[i],
-		    textpos+9, text[i+1]);
+	    Barcode_add_glyph(bc, textpos, 12, text[i], 0);
+	    Barcode_add_glyph(bc, textpos+9, 12, text[i+1], 0);
 	}
         textpos += 18; /* width of two codes */
-        textptr += strlen(textptr);
     }
-    strcat(partial, guard[1]);
+    Barcode_add_runs(bc, guard[1], 0);
 
-    bc->partial = partial;
-    bc->textinfo = textinfo;
-    free(text);
+    Barcode_free(bc, text);
 
     return 0;
 }
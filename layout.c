@@ -0,0 +1,250 @@
+/*
+ * layout.c -- where the bars and the text go, for all the backends
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * The backends used to compute the geometry on their own, each one
+ * with a copy of the same code. Now it is done here, when the item is
+ * printed first, and kept until the runs or the glyphs change or the
+ * caller changes the position: printing the same item again, even in
+ * another format, uses the same numbers.
+ *
+ * As it always did, the first layout writes back the size, offset and
+ * scale factor it chose to the item, so the caller can see them.
+ */
+
+static int Barcode_layout_valid(struct Barcode_Item *bc,
+				struct Barcode_Layout *lay)
+{
+    return lay->valid
+	&& lay->flags == (bc->flags & BARCODE_NO_ASCII)
+	&& lay->width == bc->width && lay->height == bc->height
+	&& lay->xoff == bc->xoff && lay->yoff == bc->yoff
+	&& lay->margin == bc->margin && lay->scalef == bc->scalef;
+}
+
+/* Make room for the bars and the chars, keeping the buffers if possible */
+static int Barcode_layout_alloc(struct Barcode_Item *bc, int nbars,
+				int ntexts)
+{
+    struct Barcode_Layout *lay = bc->layout;
+
+    if (!lay) {
+	lay = Barcode_malloc(bc, sizeof(*lay));
+	if (!lay)
+	    return -1;
+	memset(lay, 0, sizeof(*lay));
+	bc->layout = lay;
+    }
+    if (nbars > lay->barsize) {
+	struct Barcode_Bar *bars = Barcode_malloc(bc, nbars * sizeof(*bars));
+
+	if (!bars)
+	    return -1;
+	Barcode_free(bc, lay->bars);
+	lay->bars = bars;
+	lay->barsize = nbars;
+    }
+    if (ntexts > lay->textsize) {
+	struct Barcode_Text *texts = Barcode_malloc(bc, ntexts * sizeof(*texts));
+
+	if (!texts)
+	    return -1;
+	Barcode_free(bc, lay->texts);
+	lay->texts = texts;
+	lay->textsize = ntexts;
+    }
+    lay->nbars = lay->ntexts = 0;
+    return 0;
+}
+
+/*
+ * Return the layout of the item, or NULL (with bc->error set)
+ */
+struct Barcode_Layout *Barcode_Get_Layout(struct Barcode_Item *bc)
+{
+    struct Barcode_Layout *lay = bc->layout;
+    struct Barcode_Bar *bar;
+    struct Barcode_Text *text;
+    int i, j, barlen, below, above;
+    int noascii = bc->flags & BARCODE_NO_ASCII;
+    double scalef, xpos;
+
+    if (lay && Barcode_layout_valid(bc, lay))
+	return lay;
+
+    if (!bc->runs || (!bc->glyphs && !noascii)) {
+	bc->error = EINVAL;
+	return NULL;
+    }
+    if (Barcode_layout_alloc(bc, bc->nruns / 2,
+			     noascii ? 0 : bc->nglyphs) < 0) {
+	bc->error = ENOMEM;
+	return NULL;
+    }
+    lay = bc->layout;
+
+    /* First, calculate barlen */
+    for (barlen = i = 0; i < bc->nruns; i++)
+	barlen += bc->runs[i];
+
+    /* The scale factor depends on bar length, unless it was requested */
+    if (!bc->scalef) {
+        if (!bc->width) bc->width = barlen; /* default */
+        bc->scalef = (double)bc->width / (double)barlen;
+    }
+    scalef = bc->scalef;
+
+    /* The width defaults to "just enough" */
+    if (!bc->width) bc->width = barlen * scalef +1;
+
+    /* But it can be too small, in this case enlarge and center the area */
+    if (bc->width < barlen * scalef) {
+        int wid = barlen * scalef + 1;
+        bc->xoff -= (wid - bc->width)/2 ;
+        bc->width = wid;
+        /* Can't extend too far on the left */
+        if (bc->xoff < 0) {
+            bc->width += -bc->xoff;
+            bc->xoff = 0;
+        }
+    }
+
+    /* The height defaults to 80 points (rescaled) */
+    if (!bc->height) bc->height = 80 * scalef;
+
+    /* If too small (5 + text), reduce the scale factor and center */
+    i = 5 + 10 * (noascii == 0);
+    if (bc->height < i * scalef ) {
+        double scaleg = ((double)bc->height) / i;
+        int wid = bc->width * scaleg / scalef;
+        bc->xoff += (bc->width - wid)/2;
+        bc->width = wid;
+        scalef = scaleg;
+    }
+
+    /* The bars, leaving space for the text below or above them */
+    bar = lay->bars;
+    xpos = bc->margin + bc->runs[0] * scalef;
+    for (i=1; i<bc->nruns; i++) {
+	j = bc->runs[i];
+	if (i%2) { /* bar */
+	    below = above = 0;
+	    if (noascii)
+		;
+	    else if (!(bc->runflags[i] & BARCODE_RUN_ABOVE)) {
+		/* text below bars: 10 points or five points */
+		below = bc->runflags[i] & BARCODE_RUN_LONG ? 5 : 10;
+	    } else {
+		/* text above bars: 10 or 0 from bottom, and 10 from top */
+		below = bc->runflags[i] & BARCODE_RUN_LONG ? 0 : 10;
+		above = 10;
+	    }
+	    bar->x = xpos;
+	    bar->width = j * scalef;
+	    bar->y = below * scalef;
+	    bar->top = above * scalef;
+	    bar->height = bc->height - (below + above) * scalef;
+	    bar++;
+	}
+	xpos += j * scalef;
+    }
+    lay->nbars = bar - lay->bars;
+    lay->end = xpos;
+
+    /* Then, the text */
+    text = lay->texts;
+    for (i = 0; !noascii && i < bc->nglyphs; i++, text++) {
+	text->x = bc->glyphs[i].x * scalef;
+	text->y = bc->glyphs[i].above ? bc->height - 8 * scalef : 0;
+	text->size = bc->glyphs[i].size * scalef;
+	text->c = bc->glyphs[i].c;
+    }
+    lay->ntexts = text - lay->texts;
+
+    lay->scale = scalef;
+    lay->flags = noascii;
+    lay->width = bc->width; lay->height = bc->height;
+    lay->xoff = bc->xoff; lay->yoff = bc->yoff;
+    lay->margin = bc->margin;
+    lay->scalef = bc->scalef;
+    lay->valid = 1;
+    return lay;
+}
+
+/*
+ * Fill "m" with the dimensions of the item: it is encoded with "flags"
+ * if it was not yet, and the layout is the one printing it would use
+ * (BARCODE_NO_ASCII in "flags" is honored like Barcode_Print does).
+ * Nothing is printed and no string is built. Returns 0 or -1
+ */
+int Barcode_Measure(struct Barcode_Item *bc, int flags,
+		    struct Barcode_Measure *m)
+{
+    struct Barcode_Layout *lay;
+    struct Barcode_Text *text;
+    int i;
+
+    if (!bc->nruns && Barcode_Encode(bc, flags) < 0)
+	return -1;
+    bc->flags |= flags & BARCODE_NO_ASCII;
+    if (!(lay = Barcode_Get_Layout(bc)))
+	return -1;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < bc->nruns; i++)
+	m->barlen += bc->runs[i];
+    m->nbars = lay->nbars;
+    m->ntexts = lay->ntexts;
+    m->scale = lay->scale;
+    m->width = bc->width;
+    m->height = bc->height;
+    m->margin = bc->margin;
+    m->boxwidth = bc->width + 2 * bc->margin;
+    m->boxheight = bc->height + 2 * bc->margin;
+    if (lay->nbars) {
+	m->barx0 = lay->bars[0].x;
+	m->barx1 = lay->bars[lay->nbars - 1].x + lay->bars[lay->nbars - 1].width;
+    }
+    for (text = lay->texts; text < lay->texts + lay->ntexts; text++) {
+	if (text == lay->texts || text->x < m->textx0)
+	    m->textx0 = text->x;
+	if (text == lay->texts || text->x > m->textx1)
+	    m->textx1 = text->x;
+	if (text == lay->texts || text->y < m->texty0)
+	    m->texty0 = text->y;
+	if (text == lay->texts || text->y > m->texty1)
+	    m->texty1 = text->y;
+	if (text->size > m->textsize)
+	    m->textsize = text->size;
+    }
+    if (lay->ntexts) { /* the texts don't count the margin */
+	m->textx0 += bc->margin;
+	m->textx1 += bc->margin;
+	m->texty0 += bc->margin;
+	m->texty1 += bc->margin;
+    }
+    return 0;
+}
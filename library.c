@@ -24,12 +24,177 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <ctype.h>
 #ifdef HAVE_UNISTD_H /* sometimes (windows, for instance) it's missing */
 #  include <unistd.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+#ifdef HAVE_DLFCN_H
+#  include <dlfcn.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#  include <dirent.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <utime.h>
 #include <errno.h>
 
+/*
+ * An arena is a list of blocks, handed out by moving a pointer forward.
+ * Nothing is released until the whole arena is reset, so after the
+ * first round the same blocks are used over and over again, with no
+ * calls to malloc or free.
+ */
+union Barcode_Align { double d; void *p; long l; };
+#define ARENA_ALIGN(n) (((n) + sizeof(union Barcode_Align) - 1) \
+			& ~(sizeof(union Barcode_Align) - 1))
+
+struct Barcode_Block {
+    struct Barcode_Block *next;
+    size_t size, used;
+};
+#define BLOCK_DATA(b) ((char *)(b) + ARENA_ALIGN(sizeof(struct Barcode_Block)))
+
+struct Barcode_Arena {
+    struct Barcode_Block *first, *cur;
+    size_t blocksize;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock; /* items of an arena may be batch-encoded */
+#endif
+};
+
+#define BARCODE_ARENA_DEFAULT 65536
+
+static struct Barcode_Block *Barcode_arena_block(size_t size)
+{
+    struct Barcode_Block *b;
+
+    b = malloc(ARENA_ALIGN(sizeof(*b)) + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+/*
+ * Create an arena; "size" is the size of each block, 0 for the default
+ */
+struct Barcode_Arena *Barcode_Arena_Create(size_t size)
+{
+    struct Barcode_Arena *arena;
+
+    arena = malloc(sizeof(*arena));
+    if (!arena) return NULL;
+    arena->blocksize = size ? ARENA_ALIGN(size) : BARCODE_ARENA_DEFAULT;
+    arena->first = arena->cur = Barcode_arena_block(arena->blocksize);
+    if (!arena->first) {
+	free(arena);
+	return NULL;
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&arena->lock, NULL);
+#endif
+    return arena;
+}
+
+/*
+ * Release all the items of an arena at once, keeping the memory
+ */
+void Barcode_Arena_Reset(struct Barcode_Arena *arena)
+{
+    struct Barcode_Block *b;
+
+    for (b = arena->first; b; b = b->next)
+	b->used = 0;
+    arena->cur = arena->first;
+}
+
+/*
+ * Release all the items and the arena itself
+ */
+void Barcode_Arena_Delete(struct Barcode_Arena *arena)
+{
+    struct Barcode_Block *b, *next;
+
+    for (b = arena->first; b; b = next) {
+	next = b->next;
+	free(b);
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&arena->lock);
+#endif
+    free(arena);
+}
+
+static void *Barcode_arena_alloc(struct Barcode_Arena *arena, size_t size)
+{
+    struct Barcode_Block *b, *new;
+    void *ptr = NULL;
+
+    size = ARENA_ALIGN(size);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&arena->lock);
+#endif
+    /* blocks after the current one are free, if the arena was reset */
+    for (b = arena->cur; b; b = b->next)
+	if (b->used + size <= b->size)
+	    break;
+    if (!b) {
+	new = Barcode_arena_block(size > arena->blocksize
+				  ? size : arena->blocksize);
+	if (new) {
+	    new->next = arena->cur->next;
+	    b = arena->cur->next = new;
+	}
+    }
+    if (b) {
+	arena->cur = b;
+	ptr = BLOCK_DATA(b) + b->used;
+	b->used += size;
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    if (!ptr)
+	errno = ENOMEM;
+    return ptr;
+}
+
+/*
+ * Memory for an item comes from its arena, if any, or from malloc.
+ * These are used by the encoders for all of their buffers.
+ */
+void *Barcode_malloc(struct Barcode_Item *bc, size_t size)
+{
+    if (bc->arena)
+	return Barcode_arena_alloc(bc->arena, size);
+    return malloc(size);
+}
+
+void Barcode_free(struct Barcode_Item *bc, void *ptr)
+{
+    if (!bc->arena)
+	free(ptr);
+}
+
+char *Barcode_strdup(struct Barcode_Item *bc, char *s)
+{
+    char *ptr = Barcode_malloc(bc, strlen(s) + 1);
+
+    if (ptr)
+	strcpy(ptr, s);
+    return ptr;
+}
+
 /*
  * This function allocates a barcode structure and strdup()s the
  * text string. It returns NULL in case of error
@@ -44,6 +209,27 @@ struct Barcode_Item *Barcode_Create(char *text)
     memset(bc, 0, sizeof(*bc));
     bc->ascii = strdup(text);
     bc->margin = BARCODE_DEFAULT_MARGIN; /* default margin */
+    bc->errpos = -1;
+    return bc;
+}
+
+/*
+ * The same, but everything for this item comes from the arena
+ */
+struct Barcode_Item *Barcode_Create_Arena(char *text,
+					  struct Barcode_Arena *arena)
+{
+    struct Barcode_Item *bc;
+
+    bc = Barcode_arena_alloc(arena, sizeof(*bc));
+    if (!bc) return NULL;
+
+    memset(bc, 0, sizeof(*bc));
+    bc->arena = arena;
+    bc->ascii = Barcode_strdup(bc, text);
+    if (!bc->ascii) return NULL;
+    bc->margin = BARCODE_DEFAULT_MARGIN; /* default margin */
+    bc->errpos = -1;
     return bc;
 }
 
@@ -53,22 +239,558 @@ struct Barcode_Item *Barcode_Create(char *text)
  */
 int Barcode_Delete(struct Barcode_Item *bc)
 {
+    if (bc->arena || bc->context)
+	return 0; /* it is released with the arena or the context */
     if (bc->ascii)
 	free(bc->ascii);
     if (bc->partial)
 	free(bc->partial);
     if (bc->textinfo)
 	free(bc->textinfo);
-    if (bc->encoding)
-	free(bc->encoding);
+    if (bc->runs)
+	free(bc->runs);
+    if (bc->runflags)
+	free(bc->runflags);
+    if (bc->glyphs)
+	free(bc->glyphs);
+    if (bc->layout) {
+	free(bc->layout->bars);
+	free(bc->layout->texts);
+	free(bc->layout);
+    }
     free(bc);
     return 0; /* always success */
 }
 
 
 /*
- * The various supported encodings.  This might be extended to support
- * dynamic addition of extra encodings
+ * A context keeps one item for all the texts of an output stream:
+ * its buffers only grow, so after a while no memory is allocated.
+ * The stream state (fonts, cursor, pages) is used by the backends.
+ */
+struct Barcode_Context *Barcode_Context_Create(int flags)
+{
+    struct Barcode_Context *ctx;
+
+    ctx = malloc(sizeof(*ctx));
+    if (!ctx) return NULL;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->flags = flags;
+    ctx->item.context = ctx;
+    ctx->item.margin = BARCODE_DEFAULT_MARGIN;
+    ctx->item.errpos = -1;
+    return ctx;
+}
+
+void Barcode_Context_Delete(struct Barcode_Context *ctx)
+{
+    struct Barcode_Item *bc = &ctx->item;
+
+    if (bc->ascii)
+	free(bc->ascii);
+    if (bc->partial)
+	free(bc->partial);
+    if (bc->textinfo)
+	free(bc->textinfo);
+    if (bc->runs)
+	free(bc->runs);
+    if (bc->runflags)
+	free(bc->runflags);
+    if (bc->glyphs)
+	free(bc->glyphs);
+    if (bc->layout) {
+	free(bc->layout->bars);
+	free(bc->layout->texts);
+	free(bc->layout);
+    }
+    Barcode_Context_Fragments(ctx, 0);
+    Barcode_Context_Cache_Dir(ctx, NULL, 0);
+    Barcode_Context_Incremental(ctx, 0);
+    free(ctx);
+}
+
+/*
+ * Prepare the item of the context for a new text, as if it was just
+ * created. Returns the item, or NULL in case of error (with errno set)
+ */
+struct Barcode_Item *Barcode_Reset(struct Barcode_Context *ctx, char *text)
+{
+    struct Barcode_Item *bc = &ctx->item;
+    int len = strlen(text) + 1;
+    char *ascii;
+
+    if (len > ctx->asciisize) {
+	ascii = malloc(len);
+	if (!ascii) return NULL;
+	free(bc->ascii);
+	bc->ascii = ascii;
+	ctx->asciisize = len;
+    }
+    memcpy(bc->ascii, text, len);
+
+    if (bc->partial)
+	free(bc->partial);
+    if (bc->textinfo)
+	free(bc->textinfo);
+    bc->partial = bc->textinfo = NULL;
+    bc->nruns = bc->nglyphs = 0;
+    if (bc->layout) /* keep its buffers, like the runs */
+	bc->layout->valid = 0;
+
+    bc->flags = ctx->flags;
+    bc->encoding = NULL;
+    bc->width = bc->height = bc->xoff = bc->yoff = 0;
+    bc->margin = BARCODE_DEFAULT_MARGIN;
+    bc->scalef = 0.0;
+    bc->error = 0;
+    bc->errpos = -1;
+    return bc;
+}
+
+/*
+ * Tell the context that a new page begins: the state of the printer
+ * is not known any more. Returns the number of the new page
+ */
+int Barcode_Context_Page(struct Barcode_Context *ctx)
+{
+    ctx->psfont = ctx->pclfont = 0;
+    ctx->pclcursor = 0;
+    return ++ctx->page;
+}
+
+/*
+ * Incremental encoding. Serial numbers printed one after the other
+ * only differ in their last chars, so an encoder can save its state
+ * before each char (the runs and glyphs so far, the running checksum)
+ * and, when the next text of the context begins like the previous one,
+ * restore it and encode only the rest. The state is compared through
+ * a "key" of the encoder's choice (usually the text) and a "tag" that
+ * tells how the key was encoded.
+ */
+struct Barcode_Resume {
+    int valid;         /* cleared when the runs are discarded */
+    int tag, flags;    /* what the checkpoints belong to */
+    char *key;         /* and the key they were taken from */
+    int len, keysize;
+    struct Barcode_Checkpoint *cp; /* one for each char of the key */
+    int cpsize;
+};
+
+/*
+ * The encoders describe the bars in the "runs" array: one byte for
+ * each bar or space, holding its width as a multiple of the base
+ * dimension. The first run is the extra space to leave at the left
+ * of the bars (for EAN-13, it hosts the first digit), then bars and
+ * spaces alternate, so bars have odd indexes. Each run has an entry
+ * in "runflags" too: BARCODE_RUN_LONG marks the bars that extend
+ * lower than the others, BARCODE_RUN_ABOVE marks the runs where the
+ * text is printed above the bars (used by the EAN/UPC add-ons).
+ *
+ * This function makes room for "n" runs, discarding the previous
+ * ones. Returns 0 or -1 (with bc->error set).
+ */
+int Barcode_alloc_runs(struct Barcode_Item *bc, int n)
+{
+    unsigned char *runs, *runflags;
+
+    if (bc->partial) /* it is built from the runs: invalid now */
+	Barcode_free(bc, bc->partial);
+    bc->partial = NULL;
+    if (bc->layout) /* the same */
+	bc->layout->valid = 0;
+    if (bc->context && bc->context->resume) /* and its checkpoints */
+	bc->context->resume->valid = 0;
+    bc->nruns = 0;
+    if (n <= bc->runsize)
+	return 0;
+
+    /* the old runs are discarded, so there's no need to realloc */
+    runs = Barcode_malloc(bc, n);
+    runflags = Barcode_malloc(bc, n);
+    if (!runs || !runflags) {
+	bc->error = errno;
+	Barcode_free(bc, runs);
+	Barcode_free(bc, runflags);
+	return -1;
+    }
+    Barcode_free(bc, bc->runs);
+    Barcode_free(bc, bc->runflags);
+    bc->runs = runs;
+    bc->runflags = runflags;
+    bc->runsize = n;
+    return 0;
+}
+
+/*
+ * Append the runs described by a pattern, in the same alphabet used
+ * by the "partial" string: digits are widths and lower-case letters
+ * are long bars ('a' is 1, 'b' is 2...). The caller must have made
+ * room for them with Barcode_alloc_runs().
+ */
+void Barcode_add_runs(struct Barcode_Item *bc, char *pattern, int flags)
+{
+    unsigned char *runs = bc->runs + bc->nruns;
+    unsigned char *runflags = bc->runflags + bc->nruns;
+
+    for (; *pattern; pattern++) {
+	if (*pattern >= 'a') {
+	    *runs++ = *pattern - 'a' + 1;
+	    *runflags++ = flags | BARCODE_RUN_LONG;
+	} else {
+	    *runs++ = *pattern - '0';
+	    *runflags++ = flags;
+	}
+    }
+    bc->nruns = runs - bc->runs;
+}
+
+/*
+ * The "partial" string is the textual form of the runs, as it was
+ * generated by the encoders before the runs were introduced. Build
+ * it on request; it is released when the item is encoded again.
+ */
+char *Barcode_Partial(struct Barcode_Item *bc)
+{
+    int i, mode = 0;
+    char *ptr;
+
+    if (bc->partial || !bc->runs)
+	return bc->partial;
+
+    /* a mode change takes one char too, count them all as such */
+    ptr = bc->partial = Barcode_malloc(bc, 2 * bc->nruns + 1);
+    if (!ptr) {
+	bc->error = errno;
+	return NULL;
+    }
+    for (i = 0; i < bc->nruns; i++) {
+	if ((bc->runflags[i] & BARCODE_RUN_ABOVE) != mode) {
+	    mode = bc->runflags[i] & BARCODE_RUN_ABOVE;
+	    *ptr++ = mode ? '+' : '-';
+	}
+	if (bc->runflags[i] & BARCODE_RUN_LONG)
+	    *ptr++ = 'a' + bc->runs[i] - 1;
+	else
+	    *ptr++ = '0' + bc->runs[i];
+    }
+    *ptr = '\0';
+    return bc->partial;
+}
+
+/*
+ * The text is described by the "glyphs" array in the same way: one
+ * entry for each char, with its position (in bar units, counting the
+ * first run too), its font size and whether it goes above the bars.
+ *
+ * Like Barcode_alloc_runs, this makes room for "n" glyphs and
+ * discards the previous ones. Returns 0 or -1 (with bc->error set).
+ * An item encoded with BARCODE_NO_ASCII gets no glyphs at all: the
+ * encoders add them anyway, and they are dropped.
+ */
+int Barcode_alloc_glyphs(struct Barcode_Item *bc, int n)
+{
+    struct Barcode_Glyph *glyphs;
+
+    if (bc->flags & BARCODE_NO_ASCII)
+	n = 0;
+
+    if (bc->textinfo) /* it is built from the glyphs: invalid now */
+	Barcode_free(bc, bc->textinfo);
+    bc->textinfo = NULL;
+    if (bc->layout)
+	bc->layout->valid = 0;
+    bc->nglyphs = 0;
+    if (n <= bc->glyphsize)
+	return 0;
+
+    glyphs = Barcode_malloc(bc, n * sizeof(*glyphs));
+    if (!glyphs) {
+	bc->error = errno;
+	return -1;
+    }
+    Barcode_free(bc, bc->glyphs);
+    bc->glyphs = glyphs;
+    bc->glyphsize = n;
+    return 0;
+}
+
+/*
+ * Append one glyph. The caller must have made room for it.
+ */
+void Barcode_add_glyph(struct Barcode_Item *bc, double x, double size,
+		       int c, int above)
+{
+    struct Barcode_Glyph *g;
+
+    if (bc->flags & BARCODE_NO_ASCII)
+	return;
+    g = bc->glyphs + bc->nglyphs++;
+    g->x = x;
+    g->size = size;
+    g->c = c;
+    g->above = above;
+}
+
+/*
+ * The "textinfo" string is the textual form of the glyphs: fields
+ * "%g:%g:%c" separated by blank space, with a standalone "+" or "-"
+ * before a change in the text position. Build it on request like
+ * the "partial" string.
+ */
+char *Barcode_Textinfo(struct Barcode_Item *bc)
+{
+    int i, above = 0;
+    char *ptr;
+
+    if (bc->textinfo || !bc->runs)
+	return bc->textinfo;
+
+    /* a "%g" is at most 13 chars: 30 per field, 2 more for the mode */
+    ptr = bc->textinfo = Barcode_malloc(bc, 32 * bc->nglyphs + 1);
+    if (!ptr) {
+	bc->error = errno;
+	return NULL;
+    }
+    *ptr = '\0';
+    for (i = 0; i < bc->nglyphs; i++) {
+	if (bc->glyphs[i].above != above) {
+	    above = bc->glyphs[i].above;
+	    ptr += sprintf(ptr, "%s%c", i ? " " : "", above ? '+' : '-');
+	}
+	ptr += sprintf(ptr, "%s%g:%g:%c", ptr == bc->textinfo ? "" : " ",
+		       bc->glyphs[i].x, bc->glyphs[i].size, bc->glyphs[i].c);
+    }
+    /* as before the glyphs, all but the EAN family end with a blank */
+    switch (bc->flags & BARCODE_ENCODING_MASK) {
+    case BARCODE_EAN: case BARCODE_UPC: case BARCODE_ISBN:
+	break;
+    default:
+	if (bc->nglyphs)
+	    strcpy(ptr, " ");
+    }
+    return bc->textinfo;
+}
+
+/*
+ * Used by the encoders when the text can't be encoded: "pos" is the
+ * first char that is wrong, or where one more is needed. What was
+ * built so far is discarded. Returns -1.
+ */
+int Barcode_text_error(struct Barcode_Item *bc, int pos)
+{
+    Barcode_alloc_runs(bc, 0);
+    Barcode_alloc_glyphs(bc, 0);
+    bc->error = EINVAL;
+    bc->errpos = pos;
+    return -1;
+}
+
+/*
+ * The encoders check the text in the same pass that encodes it, so a
+ * verify function can just encode to a scratch item. Returns 0 or -1.
+ */
+int Barcode_verify_text(char *text, int (*encode)(struct Barcode_Item *bc))
+{
+    struct Barcode_Item item;
+    int retval;
+
+    memset(&item, 0, sizeof(item));
+    item.ascii = text;
+    item.errpos = -1;
+    retval = encode(&item);
+    Barcode_free(&item, item.partial);
+    Barcode_free(&item, item.textinfo);
+    Barcode_free(&item, item.runs);
+    Barcode_free(&item, item.runflags);
+    Barcode_free(&item, item.glyphs);
+    return retval < 0 ? -1 : 0;
+}
+
+
+/* make room for "n" checkpoints, keeping the current ones */
+static int Barcode_resume_room(struct Barcode_Resume *r, int n)
+{
+    struct Barcode_Checkpoint *cp;
+    int size;
+
+    if (n <= r->cpsize)
+	return 0;
+    for (size = r->cpsize ? r->cpsize : 32; size < n; size *= 2)
+	;
+    if (!(cp = realloc(r->cp, size * sizeof(*cp))))
+	return -1;
+    r->cp = cp;
+    r->cpsize = size;
+    return 0;
+}
+
+/* make room for "n" runs and "nglyphs" glyphs, keeping those before "cp" */
+static int Barcode_resume_grow(struct Barcode_Item *bc, int n, int nglyphs,
+			       struct Barcode_Checkpoint *cp)
+{
+    unsigned char *runs = NULL, *runflags = NULL;
+    struct Barcode_Glyph *glyphs = NULL;
+
+    if (n > bc->runsize) {
+	runs = Barcode_malloc(bc, n);
+	runflags = Barcode_malloc(bc, n);
+	if (!runs || !runflags)
+	    goto fail;
+    }
+    if (nglyphs > bc->glyphsize
+	&& !(glyphs = Barcode_malloc(bc, nglyphs * sizeof(*glyphs))))
+	goto fail;
+    if (runs) {
+	memcpy(runs, bc->runs, cp->nruns);
+	memcpy(runflags, bc->runflags, cp->nruns);
+	Barcode_free(bc, bc->runs);
+	Barcode_free(bc, bc->runflags);
+	bc->runs = runs;
+	bc->runflags = runflags;
+	bc->runsize = n;
+    }
+    if (glyphs) {
+	memcpy(glyphs, bc->glyphs, cp->nglyphs * sizeof(*glyphs));
+	Barcode_free(bc, bc->glyphs);
+	bc->glyphs = glyphs;
+	bc->glyphsize = nglyphs;
+    }
+    return 0;
+
+ fail:
+    bc->error = errno;
+    Barcode_free(bc, runs);
+    Barcode_free(bc, runflags);
+    return -1;
+}
+
+/*
+ * Used by the encoders instead of Barcode_alloc_runs and _glyphs: it
+ * makes room for "nruns" runs and "nglyphs" glyphs, and returns where
+ * to start in the key. If it is not 0, the runs and glyphs before it
+ * are still there and "cp" is the state the encoder saved at that
+ * point. Returns -1 on failure (with bc->error set)
+ */
+int Barcode_resume(struct Barcode_Item *bc, int tag, char *key, int len,
+		   int nruns, int nglyphs, struct Barcode_Checkpoint **cp)
+{
+    struct Barcode_Resume *r = bc->context ? bc->context->resume : NULL;
+    int i, p = 0, k = 0;
+
+    *cp = NULL;
+    if (bc->flags & BARCODE_NO_ASCII)
+	nglyphs = 0;
+    if (r && Barcode_resume_room(r, len) < 0) {
+	r->valid = r->len = 0; /* no checkpoints this time */
+	r = NULL;
+    }
+    if (r && r->valid && r->tag == tag
+	&& r->flags == (bc->flags & (BARCODE_ENCODING_MASK
+				     | BARCODE_NO_CHECKSUM
+				     | BARCODE_NO_ASCII))) {
+	while (p < len && p < r->len && key[p] == r->key[p])
+	    p++;
+	/* the last checkpoint before the first different char */
+	for (k = p < r->len ? p : r->len - 1; k > 0; k--)
+	    if (r->cp[k].nruns >= 0)
+		break;
+    }
+    if (k > 0 && Barcode_resume_grow(bc, nruns, nglyphs, r->cp + k) == 0) {
+	if (bc->partial)
+	    Barcode_free(bc, bc->partial);
+	if (bc->textinfo)
+	    Barcode_free(bc, bc->textinfo);
+	bc->partial = bc->textinfo = NULL;
+	if (bc->layout)
+	    bc->layout->valid = 0;
+	bc->nruns = r->cp[k].nruns;
+	bc->nglyphs = r->cp[k].nglyphs;
+	*cp = r->cp + k;
+    } else {
+	k = 0;
+	if (Barcode_alloc_runs(bc, nruns) < 0
+	    || Barcode_alloc_glyphs(bc, nglyphs) < 0)
+	    return -1;
+    }
+    if (!r)
+	return k;
+
+    /* the checkpoints after this one are taken again, if needed */
+    r->valid = 0;
+    r->len = len;
+    for (i = k + 1; i < len; i++)
+	r->cp[i].nruns = -1;
+    r->tag = tag;
+    r->flags = bc->flags & (BARCODE_ENCODING_MASK | BARCODE_NO_CHECKSUM
+			    | BARCODE_NO_ASCII);
+    return k;
+}
+
+/*
+ * Save the state before char "i" of the key: this fills the counters
+ * of runs and glyphs, and returns the checkpoint for the encoder to
+ * complete, or NULL if the state is not kept
+ */
+struct Barcode_Checkpoint *Barcode_checkpoint(struct Barcode_Item *bc, int i)
+{
+    struct Barcode_Resume *r = bc->context ? bc->context->resume : NULL;
+    struct Barcode_Checkpoint *cp;
+
+    if (!r || i >= r->len)
+	return NULL;
+    cp = r->cp + i;
+    cp->nruns = bc->nruns;
+    cp->nglyphs = bc->nglyphs;
+    return cp;
+}
+
+/*
+ * Called by the encoders after success, with the same key passed to
+ * Barcode_resume: the checkpoints can be used by the next text
+ */
+void Barcode_resume_end(struct Barcode_Item *bc, char *key, int len)
+{
+    struct Barcode_Resume *r = bc->context ? bc->context->resume : NULL;
+    char *s;
+
+    if (!r || r->len != len)
+	return;
+    if (len > r->keysize) {
+	if (!(s = malloc(len)))
+	    return;
+	free(r->key);
+	r->key = s;
+	r->keysize = len;
+    }
+    memcpy(r->key, key, len);
+    r->valid = 1;
+}
+
+/*
+ * Encode the texts of the context incrementally, or not. Returns 0 or
+ * -1 with errno set
+ */
+int Barcode_Context_Incremental(struct Barcode_Context *ctx, int on)
+{
+    struct Barcode_Resume *r = ctx->resume;
+
+    if (r && !on) {
+	free(r->key);
+	free(r->cp);
+	free(r);
+	ctx->resume = NULL;
+    }
+    if (!ctx->resume && on) {
+	if (!(ctx->resume = calloc(1, sizeof(*ctx->resume))))
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * The various supported encodings. Other ones can be registered at
+ * run time, by the application or by plugins
  */
 extern int Barcode_ean_verify(char *text);
 extern int Barcode_ean_encode(struct Barcode_Item *bc);
@@ -104,91 +826,1412 @@ extern int Barcode_11_encode(struct Barcode_Item *bc);
 
 struct encoding {
     int type;
+    char *name;
     int (*verify)(char *text);
     int (*encode)(struct Barcode_Item *bc);
+    int checks;  /* whether encode() checks the text by itself */
 };
 
-struct encoding encodings[] = {
-    {BARCODE_EAN,    Barcode_ean_verify,    Barcode_ean_encode},
-    {BARCODE_UPC,    Barcode_upc_verify,    Barcode_upc_encode},
-    {BARCODE_ISBN,   Barcode_isbn_verify,   Barcode_isbn_encode},
-    {BARCODE_128B,   Barcode_128b_verify,   Barcode_128b_encode},
-    {BARCODE_128C,   Barcode_128c_verify,   Barcode_128c_encode},
-    {BARCODE_128RAW, Barcode_128raw_verify, Barcode_128raw_encode},
-    {BARCODE_39,     Barcode_39_verify,     Barcode_39_encode},
-    {BARCODE_39EXT,  Barcode_39ext_verify,  Barcode_39ext_encode},
-    {BARCODE_I25,    Barcode_i25_verify,    Barcode_i25_encode},
-    {BARCODE_128,    Barcode_128_verify,    Barcode_128_encode},
-    {BARCODE_CBR,    Barcode_cbr_verify,    Barcode_cbr_encode},
-    {BARCODE_PLS,    Barcode_pls_verify,    Barcode_pls_encode},
-    {BARCODE_MSI,    Barcode_msi_verify,    Barcode_msi_encode},
-    {BARCODE_93,     Barcode_93_verify,     Barcode_93_encode},
-	{BARCODE_11,     Barcode_11_verify,     Barcode_11_encode},
-    {0,              NULL,                  NULL}
+/* this is indexed by type, so the built-in ones follow the enum order */
+static struct encoding encodings[BARCODE_ENCODING_MASK + 1] = {
+    {BARCODE_ANY,    NULL,     NULL,                  NULL,                  0},
+    {BARCODE_EAN,    "ean",    Barcode_ean_verify,    Barcode_ean_encode,    1},
+    {BARCODE_UPC,    "upc",    Barcode_upc_verify,    Barcode_upc_encode,    1},
+    {BARCODE_ISBN,   "isbn",   Barcode_isbn_verify,   Barcode_isbn_encode,   1},
+    {BARCODE_39,     "39",     Barcode_39_verify,     Barcode_39_encode,     1},
+    {BARCODE_128,    "128",    Barcode_128_verify,    Barcode_128_encode,    1},
+    {BARCODE_128C,   "128c",   Barcode_128c_verify,   Barcode_128c_encode,   1},
+    {BARCODE_128B,   "128b",   Barcode_128b_verify,   Barcode_128b_encode,   1},
+    {BARCODE_I25,    "i25",    Barcode_i25_verify,    Barcode_i25_encode,    1},
+    {BARCODE_128RAW, "128raw", Barcode_128raw_verify, Barcode_128raw_encode, 1},
+    {BARCODE_CBR,    "cbr",    Barcode_cbr_verify,    Barcode_cbr_encode,    1},
+    {BARCODE_MSI,    "msi",    Barcode_msi_verify,    Barcode_msi_encode,    1},
+    {BARCODE_PLS,    "pls",    Barcode_pls_verify,    Barcode_pls_encode,    1},
+    {BARCODE_93,     "93",     Barcode_93_verify,     Barcode_93_encode,     1},
+    {BARCODE_11,     "11",     Barcode_11_verify,     Barcode_11_encode,     1},
+    {BARCODE_39EXT,  "39ext",  Barcode_39ext_verify,  Barcode_39ext_encode,  1},
 };
 
 /*
- * A function to encode a string into bc->partial, ready for
- * postprocessing to the output file. Meaningful bits for "flags" are
- * the encoding mask and the no-checksum flag. These bits
- * get saved in the data structure.
+ * The order used to find a code able to handle a text. The built-in
+ * encodings come first, and are chosen by Barcode_Classify()
  */
-int Barcode_Encode(struct Barcode_Item *bc, int flags)
-{
-    int validbits = BARCODE_ENCODING_MASK | BARCODE_NO_CHECKSUM;
-    struct encoding *cptr;
-
-    /* If any flag is cleared in "flags", inherit it from "bc->flags" */
-    if (!(flags & BARCODE_ENCODING_MASK))
-	flags |= bc->flags & BARCODE_ENCODING_MASK;
-    if (!(flags & BARCODE_NO_CHECKSUM))
-	flags |= bc->flags & BARCODE_NO_CHECKSUM;
-    flags = bc->flags = (flags & validbits) | (bc->flags & ~validbits);
+#define BUILTIN_ENCODINGS 15
+static int encoding_order[BARCODE_ENCODING_MASK] = {
+    BARCODE_EAN, BARCODE_UPC, BARCODE_ISBN, BARCODE_128B, BARCODE_128C,
+    BARCODE_128RAW, BARCODE_39, BARCODE_39EXT, BARCODE_I25, BARCODE_128,
+    BARCODE_CBR, BARCODE_PLS, BARCODE_MSI, BARCODE_93, BARCODE_11
+};
+static int nencodings = BUILTIN_ENCODINGS;
 
-    if (!(flags & BARCODE_ENCODING_MASK)) {
-	/* get the first code able to handle the text */
-	for (cptr = encodings; cptr->verify; cptr++)
-	    if (cptr->verify((char *)bc->ascii)==0)
+/*
+ * Add an encoding. If "type" is 0, the first free one is used. Returns
+ * the type, or -1 with errno set. This is not thread-safe: register
+ * the encodings before using the library from several threads.
+ */
+int Barcode_Register_Encoding(int type, char *name,
+			      int (*verify)(char *text),
+			      int (*encode)(struct Barcode_Item *bc))
+{
+    if (type < 0 || type > BARCODE_ENCODING_MASK || !verify || !encode) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (!type) {
+	for (type = 1; type <= BARCODE_ENCODING_MASK; type++)
+	    if (!encodings[type].verify)
 		break;
-	if (!cptr->verify) {
-	    bc->error = EINVAL; /* no code can handle this text */
+	if (type > BARCODE_ENCODING_MASK) {
+	    errno = ENOSPC;
 	    return -1;
 	}
-	flags |= cptr->type; /* this works */
-	bc->flags |= cptr->type;
+    } else if (encodings[type].verify) {
+	errno = EEXIST;
+	return -1;
     }
-    for (cptr = encodings; cptr->verify; cptr++)
-	if (cptr->type == (flags & BARCODE_ENCODING_MASK))
-	    break;
+    encodings[type].type = type;
+    encodings[type].name = name;
+    encodings[type].verify = verify;
+    encodings[type].encode = encode;
+    encodings[type].checks = 0; /* we can't know */
+    encoding_order[nencodings++] = type;
+    return type;
+}
+
+/*
+ * Return the type of the encoding called "name", or -1
+ */
+int Barcode_Encoding_Type(char *name)
+{
+    int type;
+
+    for (type = 1; type <= BARCODE_ENCODING_MASK; type++)
+	if (encodings[type].name && !strcmp(encodings[type].name, name))
+	    return type;
+    return -1;
+}
+
+/*
+ * Return the name of an encoding type, or NULL if there's none
+ */
+char *Barcode_Encoding_Name(int type)
+{
+    if (type <= 0 || type > BARCODE_ENCODING_MASK)
+	return NULL;
+    return encodings[type].name;
+}
+
+/*
+ * Load extra encodings from a shared object. It must define a function
+ * "int barcode_plugin_init(void)", that registers them and returns 0
+ * (or -1 with errno set). Returns 0 or -1 with errno set.
+ */
+int Barcode_Load_Encodings(char *path)
+{
+#ifdef HAVE_DLFCN_H
+    void *handle;
+    int (*init)(void);
+
+    handle = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+    if (!handle) {
+	/* dlopen() doesn't set errno; at least tell if the file is there */
+	if (!access(path, R_OK))
+	    errno = ENOEXEC;
+	return -1;
+    }
+    *(void **)&init = dlsym(handle, "barcode_plugin_init");
+    if (!init) {
+	dlclose(handle);
+	errno = ENOEXEC;
+	return -1;
+    }
+    /* never closed: the encoders may be used till the end */
+    return init();
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * A cache of encoded texts, for programs that encode the same texts
+ * over and over. It is split in shards, each with its own lock and
+ * its own LRU list, so threads rarely wait for each other. An entry
+ * never changes once it is in the cache: a hit copies its runs and
+ * glyphs to the item, that owns its buffers as usual (they may come
+ * from an arena or belong to a context).
+ */
+#define CACHE_SHARDS 16 /* a power of two */
+
+struct Barcode_Cached {
+    struct Barcode_Cached *next;        /* in the hash chain */
+    struct Barcode_Cached *newer, *older; /* in the LRU list */
+    unsigned long hash;
+    char *ascii;       /* the key: the text and the flags */
+    int flags;
+    int type;          /* the encoding used, if it was BARCODE_ANY */
+    char *encoding;
+    int width;         /* what the encoder set, if it was 0 */
+    unsigned char *runs, *runflags;
+    int nruns;
+    struct Barcode_Glyph *glyphs;
+    int nglyphs;
+};
+
+struct Barcode_Shard {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+    struct Barcode_Cached **table;
+    unsigned long mask;              /* the size of the table, minus 1 */
+    struct Barcode_Cached *newest, *oldest;
+    int n, max;
+    unsigned long hits, misses, evictions;
+};
+
+static struct Barcode_Shard *cache; /* NULL if there's no cache */
+
+#ifdef HAVE_PTHREAD_H
+#  define CACHE_LOCK(sh)   pthread_mutex_lock(&(sh)->lock)
+#  define CACHE_UNLOCK(sh) pthread_mutex_unlock(&(sh)->lock)
+#else
+#  define CACHE_LOCK(sh)
+#  define CACHE_UNLOCK(sh)
+#endif
+
+static unsigned long Barcode_cache_hash(char *text, int flags)
+{
+    unsigned long hash = 2166136261UL ^ flags; /* FNV-1a */
+
+    while (*text)
+	hash = (hash ^ (unsigned char)*text++) * 16777619UL;
+    return hash;
+}
+
+static void Barcode_cache_unlink(struct Barcode_Shard *sh,
+				 struct Barcode_Cached *e)
+{
+    if (e->newer) e->newer->older = e->older;
+    else sh->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else sh->oldest = e->newer;
+}
+
+static void Barcode_cache_push(struct Barcode_Shard *sh,
+			       struct Barcode_Cached *e)
+{
+    e->newer = NULL;
+    e->older = sh->newest;
+    if (sh->newest) sh->newest->newer = e;
+    else sh->oldest = e;
+    sh->newest = e;
+}
+
+/* Look for the entry, and make it the most recent one */
+static struct Barcode_Cached *Barcode_cache_find(struct Barcode_Shard *sh,
+						 unsigned long hash,
+						 char *text, int flags)
+{
+    struct Barcode_Cached *e;
+
+    for (e = sh->table[(hash / CACHE_SHARDS) & sh->mask]; e; e = e->next)
+	if (e->hash == hash && e->flags == flags && !strcmp(e->ascii, text))
+	    break;
+    if (e && e != sh->newest) {
+	Barcode_cache_unlink(sh, e);
+	Barcode_cache_push(sh, e);
+    }
+    return e;
+}
+
+static void Barcode_cache_evict(struct Barcode_Shard *sh)
+{
+    struct Barcode_Cached *e = sh->oldest, **pe;
+
+    pe = sh->table + ((e->hash / CACHE_SHARDS) & sh->mask);
+    while (*pe != e)
+	pe = &(*pe)->next;
+    *pe = e->next;
+    Barcode_cache_unlink(sh, e);
+    free(e);
+    sh->n--;
+    sh->evictions++;
+}
+
+/*
+ * Fill the item from the cache. Returns 0, or -1 if the text is not
+ * there (or if there's no memory for the copy)
+ */
+static int Barcode_cache_get(struct Barcode_Item *bc, int flags,
+			     unsigned long hash)
+{
+    struct Barcode_Shard *sh = cache + (hash & (CACHE_SHARDS - 1));
+    struct Barcode_Cached *e;
+    int retval = -1;
+
+    CACHE_LOCK(sh);
+    e = Barcode_cache_find(sh, hash, bc->ascii, flags);
+    if (!e)
+	sh->misses++;
+    else if (Barcode_alloc_runs(bc, e->nruns) == 0
+	     && Barcode_alloc_glyphs(bc, e->nglyphs) == 0) {
+	sh->hits++;
+	memcpy(bc->runs, e->runs, e->nruns);
+	memcpy(bc->runflags, e->runflags, e->nruns);
+	bc->nruns = e->nruns;
+	memcpy(bc->glyphs, e->glyphs, e->nglyphs * sizeof(*e->glyphs));
+	bc->nglyphs = e->nglyphs;
+	bc->flags |= e->type;
+	bc->encoding = e->encoding;
+	if (!bc->width)
+	    bc->width = e->width;
+	retval = 0;
+    }
+    CACHE_UNLOCK(sh);
+    return retval;
+}
+
+/* Save a copy of the item, just encoded. Failures are not important */
+static void Barcode_cache_put(struct Barcode_Item *bc, int flags,
+			      unsigned long hash, int width)
+{
+    struct Barcode_Shard *sh = cache + (hash & (CACHE_SHARDS - 1));
+    struct Barcode_Cached *e, **pe;
+    size_t glyphs = ARENA_ALIGN(sizeof(*e));
+    size_t runs = glyphs + bc->nglyphs * sizeof(*e->glyphs);
+
+    /* one block: the entry, the glyphs, the runs and the text */
+    e = malloc(runs + 2 * bc->nruns + strlen(bc->ascii) + 1);
+    if (!e)
+	return;
+    e->hash = hash;
+    e->flags = flags;
+    e->type = bc->flags & BARCODE_ENCODING_MASK;
+    e->encoding = bc->encoding;
+    e->width = width;
+    e->glyphs = (struct Barcode_Glyph *)((char *)e + glyphs);
+    e->nglyphs = bc->nglyphs;
+    memcpy(e->glyphs, bc->glyphs, bc->nglyphs * sizeof(*e->glyphs));
+    e->runs = (unsigned char *)e + runs;
+    e->runflags = e->runs + bc->nruns;
+    e->nruns = bc->nruns;
+    memcpy(e->runs, bc->runs, bc->nruns);
+    memcpy(e->runflags, bc->runflags, bc->nruns);
+    e->ascii = (char *)e->runflags + bc->nruns;
+    strcpy(e->ascii, bc->ascii);
+
+    CACHE_LOCK(sh);
+    if (Barcode_cache_find(sh, hash, e->ascii, flags)) {
+	free(e); /* another thread was faster */
+    } else {
+	pe = sh->table + ((hash / CACHE_SHARDS) & sh->mask);
+	e->next = *pe;
+	*pe = e;
+	Barcode_cache_push(sh, e);
+	if (++sh->n > sh->max)
+	    Barcode_cache_evict(sh);
+    }
+    CACHE_UNLOCK(sh);
+}
+
+/*
+ * Use a cache of "size" encoded texts, or no cache if "size" is 0 (the
+ * default). The previous cache, if any, is dropped. Returns 0 or -1
+ * with errno set. Like the encodings, the cache must be set up before
+ * the library is used by several threads.
+ */
+int Barcode_Cache_Enable(int size)
+{
+    struct Barcode_Shard *shards;
+    unsigned long nbuckets;
+    int i;
+
+    if (size < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (cache) {
+	for (i = 0; i < CACHE_SHARDS; i++) {
+	    while (cache[i].n)
+		Barcode_cache_evict(cache + i);
+#ifdef HAVE_PTHREAD_H
+	    pthread_mutex_destroy(&cache[i].lock);
+#endif
+	    free(cache[i].table);
+	}
+	free(cache);
+	cache = NULL;
+    }
+    if (!size)
+	return 0;
+
+    shards = calloc(CACHE_SHARDS, sizeof(*shards));
+    if (!shards)
+	return -1;
+    /* about one entry per hash chain, when the cache is full */
+    for (nbuckets = 1; nbuckets * CACHE_SHARDS < size; nbuckets *= 2)
+	;
+    for (i = 0; i < CACHE_SHARDS; i++) {
+	shards[i].table = calloc(nbuckets, sizeof(*shards[i].table));
+	if (!shards[i].table) {
+	    while (i--)
+		free(shards[i].table);
+	    free(shards);
+	    return -1;
+	}
+	shards[i].mask = nbuckets - 1;
+	shards[i].max = (size + i) / CACHE_SHARDS; /* they add up to size */
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&shards[i].lock, NULL);
+#endif
+    }
+    cache = shards;
+    return 0;
+}
+
+/*
+ * Fill "stats" with the counters of the cache, all 0 if there's none
+ */
+void Barcode_Cache_Get_Stats(struct Barcode_Cache_Stats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; cache && i < CACHE_SHARDS; i++) {
+	CACHE_LOCK(cache + i);
+	stats->hits += cache[i].hits;
+	stats->misses += cache[i].misses;
+	stats->evictions += cache[i].evictions;
+	stats->entries += cache[i].n;
+	stats->size += cache[i].max;
+	CACHE_UNLOCK(cache + i);
+    }
+}
+
+/* Choose the encoding, according to bc->flags, and encode the text */
+static int Barcode_encode_text(struct Barcode_Item *bc)
+{
+    struct encoding *cptr = NULL;
+    unsigned long mask;
+    int i;
+
+    if (!(bc->flags & BARCODE_ENCODING_MASK)) {
+	/* get the first code able to handle the text, in one pass */
+	mask = Barcode_Classify(bc->ascii);
+	for (i = 0; i < nencodings; i++) {
+	    cptr = encodings + encoding_order[i];
+	    if (i < BUILTIN_ENCODINGS
+		? (mask & BARCODE_CLASS(cptr->type)) != 0
+		: cptr->verify(bc->ascii) == 0)
+		break;
+	}
+	if (i == nencodings) {
+	    bc->error = EINVAL; /* no code can handle this text */
+	    return -1;
+	}
+	bc->flags |= cptr->type; /* this works, already verified */
+	return cptr->encode(bc);
+    }
+    cptr = encodings + (bc->flags & BARCODE_ENCODING_MASK);
     if (!cptr->verify) {
 	bc->error = EINVAL; /* invalid barcode type */
 	return -1;
     }
-    if (cptr->verify(bc->ascii) != 0) {
+    /* the built-in ones check the text while encoding it */
+    if (!cptr->checks && cptr->verify(bc->ascii) != 0) {
 	bc->error = EINVAL;
 	return -1;
     }
     return cptr->encode(bc);
 }
 
+/*
+ * A function to encode a string into bc->runs, ready for
+ * postprocessing to the output file. Meaningful bits for "flags" are
+ * the encoding mask, the no-checksum flag, the no-ascii one (the
+ * text is not placed at all: it can't be printed later) and the
+ * shortest one. These bits get saved in the data structure.
+ */
+int Barcode_Encode(struct Barcode_Item *bc, int flags)
+{
+    int validbits = BARCODE_ENCODING_MASK | BARCODE_NO_CHECKSUM
+	| BARCODE_NO_ASCII | BARCODE_SHORTEST;
+    unsigned long hash;
+    int width, retval;
+
+    /* If any flag is cleared in "flags", inherit it from "bc->flags" */
+    if (!(flags & BARCODE_ENCODING_MASK))
+	flags |= bc->flags & BARCODE_ENCODING_MASK;
+    if (!(flags & BARCODE_NO_CHECKSUM))
+	flags |= bc->flags & BARCODE_NO_CHECKSUM;
+    if (!(flags & BARCODE_NO_ASCII))
+	flags |= bc->flags & BARCODE_NO_ASCII;
+    if (!(flags & BARCODE_SHORTEST))
+	flags |= bc->flags & BARCODE_SHORTEST;
+    flags = bc->flags = (flags & validbits) | (bc->flags & ~validbits);
+    bc->errpos = -1;
+
+    /* an encoder only names the code if the caller did not */
+    if (!cache || !bc->ascii || bc->encoding)
+	return Barcode_encode_text(bc);
+
+    hash = Barcode_cache_hash(bc->ascii, flags & validbits);
+    if (Barcode_cache_get(bc, flags & validbits, hash) == 0)
+	return 0;
+    /* the encoder may choose the width, but only if it is 0 */
+    width = bc->width;
+    bc->width = 0;
+    retval = Barcode_encode_text(bc);
+    if (retval == 0)
+	Barcode_cache_put(bc, flags & validbits, hash, bc->width);
+    if (width)
+	bc->width = width;
+    return retval;
+}
+
+/*
+ * Batch encoding: the array is split in contiguous slices, one per
+ * thread. Every item is only touched by the thread owning its slice,
+ * so no locking is needed and results stay in place. Batch verification
+ * is split in the same way, with a scratch item per thread.
+ */
+struct Barcode_Batch {
+    struct Barcode_Item **items; /* to encode, or */
+    char **texts;                /* to verify */
+    int *errors, *errpos;        /* what is wrong with each text */
+    int n;
+    int flags;
+    int failed;
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;
+    int running;
+#endif
+};
+
+static void *Barcode_batch_worker(void *arg)
+{
+    struct Barcode_Batch *slice = arg;
+    int i;
+
+    for (i = 0; i < slice->n; i++)
+	if (Barcode_Encode(slice->items[i], slice->flags) < 0)
+	    slice->failed++;
+    return NULL;
+}
+
+/*
+ * Run "worker" over the "n" entries of "batch" with up to "nthreads"
+ * threads (0 means one per online processor). Returns the number of
+ * failures counted by the slices.
+ */
+static int Barcode_batch_run(struct Barcode_Batch *batch, int n, int nthreads,
+			     void *(*worker)(void *))
+{
+    struct Barcode_Batch one, *slices = NULL;
+    int i, first, failed = 0;
+
+    if (n <= 0)
+	return 0;
+#ifdef HAVE_PTHREAD_H
+    if (nthreads <= 0) {
+#  ifdef _SC_NPROCESSORS_ONLN
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#  endif
+    }
+    if (nthreads > n)
+	nthreads = n;
+    if (nthreads > 1)
+	slices = calloc(nthreads, sizeof(*slices));
+#endif
+    if (!slices) { /* no threads, or no memory for them */
+	nthreads = 1;
+	slices = &one;
+    }
+
+    /* slice i gets n/nthreads entries, the first n%nthreads get one more */
+    for (i = first = 0; i < nthreads; i++) {
+	slices[i] = *batch;
+	if (batch->items)
+	    slices[i].items += first;
+	if (batch->texts)
+	    slices[i].texts += first;
+	if (batch->errors)
+	    slices[i].errors += first;
+	if (batch->errpos)
+	    slices[i].errpos += first;
+	slices[i].n = n / nthreads + (i < n % nthreads);
+	slices[i].failed = 0;
+	first += slices[i].n;
+    }
+
+#ifdef HAVE_PTHREAD_H
+    /* slice 0 is ours; if a thread can't start, do its job later */
+    for (i = 1; i < nthreads; i++)
+	slices[i].running = !pthread_create(&slices[i].thread, NULL,
+					    worker, slices + i);
+#endif
+    worker(slices);
+    for (i = 0; i < nthreads; i++) {
+#ifdef HAVE_PTHREAD_H
+	if (slices[i].running)
+	    pthread_join(slices[i].thread, NULL);
+	else if (i)
+	    worker(slices + i);
+#endif
+	failed += slices[i].failed;
+    }
+
+    if (slices != &one)
+	free(slices);
+    return failed;
+}
+
+/*
+ * Encode "n" items with up to "nthreads" threads (0 means one per
+ * online processor). Each item is encoded as by Barcode_Encode, and
+ * failures are reported in its own "error" field. Returns the number
+ * of items that could not be encoded.
+ */
+int Barcode_Encode_Batch(struct Barcode_Item **items, int n, int flags,
+			 int nthreads)
+{
+    struct Barcode_Batch batch;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.items = items;
+    batch.flags = flags;
+    return Barcode_batch_run(&batch, n, nthreads, Barcode_batch_worker);
+}
+
+/*
+ * The texts are verified by the table of encodings, as Barcode_Encode
+ * would: the encoders check them while encoding, so each thread encodes
+ * to one scratch item, reused for all of its texts and without glyphs
+ */
+static void *Barcode_verify_worker(void *arg)
+{
+    struct Barcode_Batch *slice = arg;
+    struct Barcode_Item item;
+    int i, error;
+
+    memset(&item, 0, sizeof(item));
+    for (i = 0; i < slice->n; i++) {
+	item.ascii = slice->texts[i];
+	item.flags = slice->flags | BARCODE_NO_ASCII;
+	item.encoding = NULL;
+	item.width = 0;
+	item.error = 0;
+	item.errpos = -1;
+	error = 0;
+	if (Barcode_encode_text(&item) < 0) {
+	    error = item.error ? item.error : EINVAL;
+	    slice->failed++;
+	}
+	if (slice->errors)
+	    slice->errors[i] = error;
+	if (slice->errpos)
+	    slice->errpos[i] = error ? item.errpos : -1;
+    }
+    Barcode_free(&item, item.partial);
+    Barcode_free(&item, item.textinfo);
+    Barcode_free(&item, item.runs);
+    Barcode_free(&item, item.runflags);
+    Barcode_free(&item, item.glyphs);
+    return NULL;
+}
+
+/*
+ * Verify "n" texts without keeping their encoding: the encoding type
+ * and the no-checksum bit of "flags" are used, and type 0 means any
+ * encoding able to deal with the text. For each text, "errors" (if not
+ * NULL) gets 0 or an errno-like value, and "errpos" (if not NULL) the
+ * char that can't be encoded or -1. Returns how many texts are wrong.
+ */
+int Barcode_Verify_Batch(char **texts, int n, int flags, int nthreads,
+			 int *errors, int *errpos)
+{
+    struct Barcode_Batch batch;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.texts = texts;
+    batch.errors = errors;
+    batch.errpos = errpos;
+    batch.flags = flags & (BARCODE_ENCODING_MASK | BARCODE_NO_CHECKSUM);
+    return Barcode_batch_run(&batch, n, nthreads, Barcode_verify_worker);
+}
+
+/*
+ * The output backends, in a table indexed by output type like the one
+ * for the encodings. Other ones can be registered at run time.
+ */
+extern int Barcode_ps_begin_document(struct Barcode_Context *ctx,
+				     struct Barcode_Sink *f);
+extern int Barcode_ps_begin_page(struct Barcode_Context *ctx,
+				 struct Barcode_Sink *f);
+extern int Barcode_ps_print(struct Barcode_Item *bc, struct Barcode_Sink *f);
+extern int Barcode_ps_end_page(struct Barcode_Context *ctx,
+			       struct Barcode_Sink *f);
+extern int Barcode_ps_end_document(struct Barcode_Context *ctx,
+				   struct Barcode_Sink *f);
+extern int Barcode_pcl_print(struct Barcode_Item *bc, struct Barcode_Sink *f);
+extern int Barcode_pcl_end_page(struct Barcode_Context *ctx,
+				struct Barcode_Sink *f);
+extern int Barcode_svg_print(struct Barcode_Item *bc, struct Barcode_Sink *f);
+extern int Barcode_ps_relocate(struct Barcode_Item *bc, struct Barcode_Sink *f,
+			       struct Barcode_Context *after);
+extern int Barcode_pcl_relocate(struct Barcode_Item *bc, struct Barcode_Sink *f,
+				struct Barcode_Context *after);
+
+static struct Barcode_Backend ps_backend = {
+    "ps", Barcode_ps_begin_document, Barcode_ps_begin_page,
+    Barcode_ps_print, Barcode_ps_end_page, Barcode_ps_end_document,
+    Barcode_ps_relocate
+};
+static struct Barcode_Backend eps_backend = {
+    "eps", NULL, NULL, Barcode_ps_print, NULL, NULL,
+    NULL /* no relocate: the bounding box is part of each item's output */
+};
+static struct Barcode_Backend pcl_backend = {
+    "pcl", NULL, NULL, Barcode_pcl_print, Barcode_pcl_end_page, NULL,
+    Barcode_pcl_relocate
+};
+static struct Barcode_Backend svg_backend = {
+    "svg", NULL, NULL, Barcode_svg_print, NULL, NULL,
+    NULL /* no relocate: each item is a whole document */
+};
+
+#define BACKEND_SHIFT 12 /* BARCODE_OUTPUT_MASK starts at bit 12 */
+#define BACKEND_INDEX(flags) (((flags) & BARCODE_OUTPUT_MASK) >> BACKEND_SHIFT)
+
+static struct Barcode_Backend *backends[BACKEND_INDEX(~0) + 1] = {
+    &ps_backend,  /* no output type: postscript, as always */
+    &eps_backend, /* BARCODE_OUT_EPS */
+    &ps_backend,  /* BARCODE_OUT_PS */
+    NULL,
+    &pcl_backend, /* BARCODE_OUT_PCL */
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+    &pcl_backend, /* BARCODE_OUT_PCL_III */
+    NULL, NULL, NULL,
+    &svg_backend, /* BARCODE_OUT_SVG */
+};
+
+static struct Barcode_Backend *Barcode_backend(int flags)
+{
+    struct Barcode_Backend *backend = backends[BACKEND_INDEX(flags)];
+
+    if (backend)
+	return backend;
+    /* a mix of the built-in flags: PCL wins, then SVG (as it used to) */
+    if (flags & BARCODE_OUT_PCL)
+	return &pcl_backend;
+    if (flags & BARCODE_OUT_SVG)
+	return &svg_backend;
+    return &ps_backend;
+}
+
+/*
+ * Add a backend for an output type, a value within BARCODE_OUTPUT_MASK.
+ * The structure is used in place. Returns 0 or -1 with errno set. Like
+ * encodings, backends must be registered before using threads.
+ */
+int Barcode_Register_Backend(int type, struct Barcode_Backend *backend)
+{
+    if (!type || (type & ~BARCODE_OUTPUT_MASK) || !backend
+	|| !backend->draw_item) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (backends[BACKEND_INDEX(type)]) {
+	errno = EEXIST;
+	return -1;
+    }
+    backends[BACKEND_INDEX(type)] = backend;
+    return 0;
+}
+
+/*
+ * Sinks. The buffer avoids calling "write" for each little piece, and
+ * printf goes straight into it. After an error everything is dropped,
+ * so the backends don't need to check each call: the caller checks
+ * the sink at the end
+ */
+void Barcode_Sink_Init(struct Barcode_Sink *sink,
+		       int (*write)(void *arg, const char *data, size_t len),
+		       void *arg)
+{
+    sink->write = write;
+    sink->arg = arg;
+    sink->count = 0;
+    sink->error = 0;
+    sink->len = 0;
+}
+
+static int Barcode_sink_pass(struct Barcode_Sink *sink, const char *data,
+			     size_t len)
+{
+    if (sink->write(sink->arg, data, len) < 0) {
+	sink->error = errno ? errno : EIO;
+	return -1;
+    }
+    return 0;
+}
+
+int Barcode_Sink_Flush(struct Barcode_Sink *sink)
+{
+    if (sink->error)
+	return -1;
+    if (sink->len && Barcode_sink_pass(sink, sink->buf, sink->len) < 0)
+	return -1;
+    sink->len = 0;
+    return 0;
+}
+
+int Barcode_Sink_Write(struct Barcode_Sink *sink, const char *data, size_t len)
+{
+    if (sink->error)
+	return -1;
+    sink->count += len;
+    if (len > sizeof(sink->buf) - sink->len) {
+	if (Barcode_Sink_Flush(sink) < 0)
+	    return -1;
+	if (len > sizeof(sink->buf)) /* don't copy it at all */
+	    return Barcode_sink_pass(sink, data, len);
+    }
+    memcpy(sink->buf + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+int Barcode_Sink_Printf(struct Barcode_Sink *sink, const char *fmt, ...)
+{
+    va_list args;
+    int len, room;
+    char *s;
+
+    if (sink->error)
+	return -1;
+    room = sizeof(sink->buf) - sink->len;
+    va_start(args, fmt);
+    len = vsnprintf(sink->buf + sink->len, room, fmt, args);
+    va_end(args);
+    if (len < 0) {
+	sink->error = EINVAL;
+	return -1;
+    }
+    if (len < room) { /* the usual case */
+	sink->len += len;
+	sink->count += len;
+	return len;
+    }
+    /* It didn't fit: empty the buffer, and print again */
+    if (Barcode_Sink_Flush(sink) < 0)
+	return -1;
+    if (len < sizeof(sink->buf)) {
+	va_start(args, fmt);
+	vsnprintf(sink->buf, sizeof(sink->buf), fmt, args);
+	va_end(args);
+	sink->len = len;
+	sink->count += len;
+	return len;
+    }
+    /* Longer than the buffer: a long text, most likely */
+    if (!(s = malloc(len + 1))) {
+	sink->error = ENOMEM;
+	return -1;
+    }
+    va_start(args, fmt);
+    vsnprintf(s, len + 1, fmt, args);
+    va_end(args);
+    sink->count += len;
+    len = Barcode_sink_pass(sink, s, len) < 0 ? -1 : len;
+    free(s);
+    return len;
+}
+
+static int Barcode_file_write(void *arg, const char *data, size_t len)
+{
+    return fwrite(data, 1, len, arg) == len ? 0 : -1;
+}
+
+/* A buffer only keeps what fits, but counts everything */
+struct Barcode_buffer {
+    char *buf;
+    size_t cap, used;
+};
+
+static int Barcode_buffer_write(void *arg, const char *data, size_t len)
+{
+    struct Barcode_buffer *b = arg;
+
+    if (b->used < b->cap)
+	memcpy(b->buf + b->used, data,
+	       len < b->cap - b->used ? len : b->cap - b->used);
+    b->used += len;
+    return 0;
+}
+
+/*
+ * Fragments. A sheet often holds the same code many times, at different
+ * places: a context can keep the output of the items it printed, drawn
+ * at 0,0, and only move it in place for the next ones (the backend says
+ * how, with its relocate hook). The fragments live in a hash table and
+ * in a list from the newest to the oldest, the one to be dropped first.
+ */
+struct Barcode_Fragment {
+    struct Barcode_Fragment *next;          /* in the hash chain */
+    struct Barcode_Fragment *newer, *older; /* in the LRU list */
+    unsigned long hash;
+    char *ascii;       /* the key: the text, the flags and the size */
+    char *encoding;
+    int flags;
+    int width, height, margin;
+    double scalef;
+    struct Barcode_Context after; /* the state it leaves, from 0,0 */
+    char *data;        /* the output */
+    size_t len;
+    void *map;         /* if read from the cache directory, or NULL */
+    size_t maplen;
+};
+
+struct Barcode_Fragments {
+    struct Barcode_Fragment **table;
+    unsigned long mask;
+    struct Barcode_Fragment *newest, *oldest;
+    int n, max;
+};
+
+static unsigned long Barcode_fragment_hash(struct Barcode_Item *bc)
+{
+    unsigned long hash = Barcode_cache_hash(bc->ascii, bc->flags);
+
+    hash = (hash ^ bc->width) * 16777619UL;
+    hash = (hash ^ bc->height) * 16777619UL;
+    return (hash ^ bc->margin) * 16777619UL;
+}
+
+static void Barcode_fragment_unlink(struct Barcode_Fragments *fr,
+				    struct Barcode_Fragment *e)
+{
+    if (e->newer) e->newer->older = e->older;
+    else fr->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else fr->oldest = e->newer;
+}
+
+static void Barcode_fragment_push(struct Barcode_Fragments *fr,
+				  struct Barcode_Fragment *e)
+{
+    e->newer = NULL;
+    e->older = fr->newest;
+    if (fr->newest) fr->newest->newer = e;
+    else fr->oldest = e;
+    fr->newest = e;
+}
+
+/* Look for the item, and make its fragment the most recent one */
+static struct Barcode_Fragment *Barcode_fragment_find(struct Barcode_Fragments *fr,
+						      struct Barcode_Item *bc,
+						      unsigned long hash)
+{
+    struct Barcode_Fragment *e;
+
+    for (e = fr->table[hash & fr->mask]; e; e = e->next)
+	if (e->hash == hash && e->flags == bc->flags
+	    && e->width == bc->width && e->height == bc->height
+	    && e->margin == bc->margin && e->scalef == bc->scalef
+	    && !strcmp(e->ascii, bc->ascii)
+	    && (e->encoding && bc->encoding
+		? !strcmp(e->encoding, bc->encoding)
+		: e->encoding == bc->encoding))
+	    break;
+    if (e && e != fr->newest) {
+	Barcode_fragment_unlink(fr, e);
+	Barcode_fragment_push(fr, e);
+    }
+    return e;
+}
+
+static void Barcode_fragment_evict(struct Barcode_Fragments *fr)
+{
+    struct Barcode_Fragment *e = fr->oldest, **pe;
+
+    pe = fr->table + (e->hash & fr->mask);
+    while (*pe != e)
+	pe = &(*pe)->next;
+    *pe = e->next;
+    Barcode_fragment_unlink(fr, e);
+#ifdef HAVE_SYS_MMAN_H
+    if (e->map)
+	munmap(e->map, e->maplen);
+    else
+#endif
+	free(e->map ? e->map : e->data);
+    free(e);
+    fr->n--;
+}
+
+/* A sink that grows as needed, for the fragments */
+struct Barcode_growing {
+    char *buf;
+    size_t size, used;
+};
+
+static int Barcode_growing_write(void *arg, const char *data, size_t len)
+{
+    struct Barcode_growing *g = arg;
+    size_t size;
+    char *buf;
+
+    if (g->used + len > g->size) {
+	size = g->size ? 2 * g->size : 4096;
+	while (size < g->used + len)
+	    size *= 2;
+	if (!(buf = realloc(g->buf, size))) {
+	    errno = ENOMEM;
+	    return -1;
+	}
+	g->buf = buf;
+	g->size = size;
+    }
+    memcpy(g->buf + g->used, data, len);
+    g->used += len;
+    return 0;
+}
+
+/* A new fragment for the item, with the key but no output yet */
+static struct Barcode_Fragment *Barcode_fragment_new(struct Barcode_Item *bc)
+{
+    struct Barcode_Fragment *e;
+    size_t len = strlen(bc->ascii) + 1;
+
+    e = malloc(sizeof(*e) + len + (bc->encoding ? strlen(bc->encoding) + 1 : 0));
+    if (!e) {
+	bc->error = ENOMEM;
+	return NULL;
+    }
+    e->ascii = (char *)(e + 1);
+    memcpy(e->ascii, bc->ascii, len);
+    e->encoding = NULL;
+    if (bc->encoding)
+	e->encoding = strcpy(e->ascii + len, bc->encoding);
+    e->flags = bc->flags;
+    e->width = bc->width;
+    e->height = bc->height;
+    e->margin = bc->margin;
+    e->scalef = bc->scalef;
+    e->data = NULL;
+    e->len = 0;
+    e->map = NULL;
+    return e;
+}
+
+/*
+ * Draw the item at 0,0, using the layout already computed for its real
+ * place (computing it again could choose another size). The state of
+ * the stream is a blank one, with the PCL cursor at 0,0
+ */
+static int Barcode_fragment_draw(struct Barcode_Item *bc,
+				 struct Barcode_Backend *backend,
+				 struct Barcode_Fragment *e)
+{
+    struct Barcode_Context *ctx = bc->context;
+    struct Barcode_Layout *lay = bc->layout;
+    struct Barcode_growing g = {NULL, 0, 0};
+    struct Barcode_Sink sink;
+    int xoff = bc->xoff, yoff = bc->yoff, retval;
+
+    memset(&e->after, 0, sizeof(e->after));
+    e->after.flags = ctx->flags;
+    e->after.pclcursor = 1;
+
+    bc->context = &e->after;
+    bc->xoff = lay->xoff = 0;
+    bc->yoff = lay->yoff = 0;
+    Barcode_Sink_Init(&sink, Barcode_growing_write, &g);
+    retval = backend->draw_item(bc, &sink);
+    if (retval == 0 && Barcode_Sink_Flush(&sink) < 0) {
+	bc->error = sink.error;
+	retval = -1;
+    }
+    bc->context = ctx;
+    bc->xoff = lay->xoff = xoff;
+    bc->yoff = lay->yoff = yoff;
+    if (retval < 0) {
+	free(g.buf);
+	return -1;
+    }
+    e->data = g.buf;
+    e->len = g.used;
+    return 0;
+}
+
+/*
+ * The cache directory. Each fragment is a file named after a hash of
+ * its key, that holds a header, the whole key (so a collision is just
+ * a miss) and the output. Files are written under a temporary name and
+ * renamed, so a reader never sees half a file, and are only trusted if
+ * the header and the size agree; a file removed while another program
+ * has it mapped stays valid for that program. Files that are read are
+ * touched, and when the directory is closed the least recently used
+ * ones are removed until it fits in ctx->cachemax.
+ */
+#define FRAGMENT_MAGIC "barcode fragment " PACKAGE_VERSION "\n"
+#define FRAGMENT_SUFFIX ".frag"
+
+/* The key, with the version of the library, and the path of its file */
+static char *Barcode_fragment_key(struct Barcode_Item *bc, char **path)
+{
+    struct Barcode_Context *ctx = bc->context;
+    unsigned long h1 = 2166136261UL, h2 = 5381; /* FNV-1a and djb2 */
+    char *key, *s;
+    size_t len;
+
+    len = strlen(bc->ascii) + (bc->encoding ? strlen(bc->encoding) : 1) + 128;
+    if (!(key = malloc(len)))
+	return NULL;
+    sprintf(key, "%x %i %i %i %.17g %s\n%s", bc->flags, bc->width,
+	    bc->height, bc->margin, bc->scalef,
+	    bc->encoding ? bc->encoding : "-", bc->ascii);
+    for (s = FRAGMENT_MAGIC; *s; s++)
+	h1 = (h1 ^ (unsigned char)*s) * 16777619UL;
+    for (s = key; *s; s++) {
+	h1 = (h1 ^ (unsigned char)*s) * 16777619UL;
+	h2 = h2 * 33 + (unsigned char)*s;
+    }
+    *path = malloc(strlen(ctx->cachedir) + 32);
+    if (!*path) {
+	free(key);
+	return NULL;
+    }
+    sprintf(*path, "%s/%08lx%08lx" FRAGMENT_SUFFIX, ctx->cachedir,
+	    h1 & 0xffffffffUL, h2 & 0xffffffffUL);
+    return key;
+}
+
+/* Parse the header: the state left by the fragment and the sizes */
+static int Barcode_fragment_header(char *buf, size_t size,
+				   struct Barcode_Context *after,
+				   unsigned long *keylen, unsigned long *len)
+{
+    char head[256];
+    int n = 0;
+
+    if (size > sizeof(head) - 1)
+	size = sizeof(head) - 1;
+    memcpy(head, buf, size);
+    head[size] = '\0';
+    if (strncmp(head, FRAGMENT_MAGIC, strlen(FRAGMENT_MAGIC)))
+	return -1;
+    if (sscanf(head + strlen(FRAGMENT_MAGIC), "%lu %lu %lg %lg %i %i %lg %lg\n%n",
+	       keylen, len,
+	       &after->psfont, &after->pclfont, &after->pclfontid,
+	       &after->pclcursor, &after->pclx, &after->pcly, &n) < 8 || !n)
+	return -1;
+    return strlen(FRAGMENT_MAGIC) + n;
+}
+
+/* Read the fragment of the item from the directory. Returns 0 or -1 */
+static int Barcode_fragment_load(struct Barcode_Item *bc,
+				 struct Barcode_Fragment *e)
+{
+    struct Barcode_Context after;
+    struct stat st;
+    unsigned long keylen, len;
+    char *key, *path, *buf = NULL;
+    int fd, head = -1;
+
+    if (!(key = Barcode_fragment_key(bc, &path)))
+	return -1;
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+#ifdef HAVE_SYS_MMAN_H
+	    buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	    if (buf == MAP_FAILED)
+		buf = NULL;
+#else
+	    if ((buf = malloc(st.st_size))
+		&& read(fd, buf, st.st_size) != st.st_size) {
+		free(buf);
+		buf = NULL;
+	    }
+#endif
+	}
+	close(fd);
+    }
+    memset(&after, 0, sizeof(after));
+    if (buf)
+	head = Barcode_fragment_header(buf, st.st_size, &after,
+				       &keylen, &len);
+    if (head < 0 || keylen != strlen(key) || len > st.st_size
+	|| head + keylen + len != st.st_size
+	|| memcmp(buf + head, key, keylen)) {
+	if (buf) {
+#ifdef HAVE_SYS_MMAN_H
+	    munmap(buf, st.st_size);
+#else
+	    free(buf);
+#endif
+	}
+	free(key);
+	free(path);
+	return -1;
+    }
+    e->after = after;
+    e->map = buf;
+    e->maplen = st.st_size;
+    e->data = buf + head + keylen;
+    e->len = len;
+    utime(path, NULL); /* recently used */
+    free(key);
+    free(path);
+    return 0;
+}
+
+/*
+ * The temporary files are numbered, as contexts in several threads of
+ * a process may write the same fragment to the same directory at once
+ */
+static unsigned long fragment_serial;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t fragment_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Write the fragment to the directory; it's only a cache: no errors */
+static void Barcode_fragment_save(struct Barcode_Item *bc,
+				  struct Barcode_Fragment *e)
+{
+    char *key, *path, *tmp;
+    unsigned long serial;
+    FILE *f;
+    int ok;
+
+    if (!(key = Barcode_fragment_key(bc, &path)))
+	return;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&fragment_lock);
+#endif
+    serial = fragment_serial++;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&fragment_lock);
+#endif
+    if ((tmp = malloc(strlen(path) + 48))) {
+#ifdef HAVE_UNISTD_H
+	sprintf(tmp, "%s.%lu.%lu.tmp", path, (unsigned long)getpid(), serial);
+#else
+	sprintf(tmp, "%s.%lu.tmp", path, serial);
+#endif
+	if ((f = fopen(tmp, "wb"))) {
+	    fprintf(f, FRAGMENT_MAGIC "%lu %lu %.17g %.17g %i %i %.17g %.17g\n",
+		    (unsigned long)strlen(key), (unsigned long)e->len,
+		    e->after.psfont, e->after.pclfont, e->after.pclfontid,
+		    e->after.pclcursor, e->after.pclx, e->after.pcly);
+	    fwrite(key, 1, strlen(key), f);
+	    ok = fwrite(e->data, 1, e->len, f) == e->len;
+	    if (fclose(f) == 0 && ok && rename(tmp, path) == 0)
+		tmp[0] = '\0';
+	    if (tmp[0])
+		remove(tmp);
+	}
+	free(tmp);
+    }
+    free(key);
+    free(path);
+}
+
+#ifdef HAVE_DIRENT_H
+struct Barcode_cachefile {
+    char *name;
+    time_t mtime;
+    off_t size;
+};
+
+static int Barcode_cachefile_cmp(const void *a, const void *b)
+{
+    const struct Barcode_cachefile *fa = a, *fb = b;
+
+    return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+/* Remove the least recently used fragments, until the rest fits */
+static void Barcode_cache_dir_trim(char *dir, size_t maxsize)
+{
+    struct Barcode_cachefile *files = NULL, *more;
+    struct dirent *de;
+    struct stat st;
+    size_t total = 0;
+    int i, n = 0, size = 0, len;
+    char *path;
+    DIR *d;
+
+    if (!maxsize || !(d = opendir(dir)))
+	return;
+    while ((de = readdir(d))) {
+	len = strlen(de->d_name) - strlen(FRAGMENT_SUFFIX);
+	if (len <= 0 || strcmp(de->d_name + len, FRAGMENT_SUFFIX))
+	    continue; /* not ours, or being written */
+	if (!(path = malloc(strlen(dir) + strlen(de->d_name) + 2)))
+	    break;
+	sprintf(path, "%s/%s", dir, de->d_name);
+	if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+	    free(path);
+	    continue;
+	}
+	if (n == size) {
+	    size = size ? 2 * size : 256;
+	    if (!(more = realloc(files, size * sizeof(*files)))) {
+		free(path);
+		break;
+	    }
+	    files = more;
+	}
+	files[n].name = path;
+	files[n].mtime = st.st_mtime;
+	files[n].size = st.st_size;
+	total += st.st_size;
+	n++;
+    }
+    closedir(d);
+    if (total > maxsize) {
+	qsort(files, n, sizeof(*files), Barcode_cachefile_cmp);
+	for (i = 0; i < n && total > maxsize; i++)
+	    if (remove(files[i].name) == 0)
+		total -= files[i].size;
+    }
+    for (i = 0; i < n; i++)
+	free(files[i].name);
+    free(files);
+}
+#else
+#  define Barcode_cache_dir_trim(dir, maxsize)
+#endif
+
+/*
+ * Keep the fragments of the context in "dir" too, so that a later run
+ * finds them, using up to "maxsize" bytes (0 for no limit). A NULL dir
+ * closes the current one. Returns 0 or -1 with errno set
+ */
+int Barcode_Context_Cache_Dir(struct Barcode_Context *ctx, char *dir,
+			      size_t maxsize)
+{
+    struct stat st;
+    char *s;
+
+    if (dir && !ctx->fragments) {
+	errno = EINVAL; /* the directory is used for fragments */
+	return -1;
+    }
+    if (dir && stat(dir, &st) < 0)
+	return -1;
+    if (dir && !S_ISDIR(st.st_mode)) {
+	errno = ENOTDIR;
+	return -1;
+    }
+    if (dir && !(s = strdup(dir)))
+	return -1;
+    if (ctx->cachedir) {
+	Barcode_cache_dir_trim(ctx->cachedir, ctx->cachemax);
+	free(ctx->cachedir);
+	ctx->cachedir = NULL;
+    }
+    if (dir) {
+	ctx->cachedir = s;
+	ctx->cachemax = maxsize;
+    }
+    return 0;
+}
+
+static int Barcode_print_fragment(struct Barcode_Item *bc,
+				  struct Barcode_Backend *backend,
+				  struct Barcode_Sink *sink)
+{
+    struct Barcode_Context *ctx = bc->context;
+    struct Barcode_Fragments *fr = ctx->fragments;
+    struct Barcode_Fragment *e;
+    unsigned long hash;
 
-/* 
- * When multiple output formats are supported, there will
- * be a jumpt table like the one for the types. Now we don't need it
+    /* the size of the item is only known after the layout */
+    if (!Barcode_Get_Layout(bc))
+	return -1;
+    hash = Barcode_fragment_hash(bc);
+    if ((e = Barcode_fragment_find(fr, bc, hash))) {
+	ctx->reused++;
+    } else {
+	if (!(e = Barcode_fragment_new(bc)))
+	    return -1;
+	if (ctx->cachedir && Barcode_fragment_load(bc, e) == 0) {
+	    ctx->reused++;
+	    ctx->loaded++;
+	} else if (Barcode_fragment_draw(bc, backend, e) == 0) {
+	    ctx->drawn++;
+	    if (ctx->cachedir)
+		Barcode_fragment_save(bc, e);
+	} else {
+	    free(e);
+	    return -1;
+	}
+	e->hash = hash;
+	e->next = fr->table[hash & fr->mask];
+	fr->table[hash & fr->mask] = e;
+	Barcode_fragment_push(fr, e);
+	if (++fr->n > fr->max)
+	    Barcode_fragment_evict(fr);
+    }
+    if (backend->relocate(bc, sink, NULL) < 0)
+	return -1;
+    Barcode_Sink_Write(sink, e->data, e->len);
+    return backend->relocate(bc, sink, &e->after);
+}
+
+/*
+ * Keep the output of up to "size" items printed through the context,
+ * or none if "size" is 0 (the default). Returns 0 or -1 with errno set
  */
-extern int Barcode_ps_print(struct Barcode_Item *bc, FILE *f);
-extern int Barcode_pcl_print(struct Barcode_Item *bc, FILE *f);
-extern int Barcode_svg_print(struct Barcode_Item *bc, FILE *f);
+int Barcode_Context_Fragments(struct Barcode_Context *ctx, int size)
+{
+    struct Barcode_Fragments *fr = ctx->fragments;
+    unsigned long nbuckets;
+
+    if (size < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (fr) {
+	while (fr->n)
+	    Barcode_fragment_evict(fr);
+	free(fr->table);
+	free(fr);
+	ctx->fragments = NULL;
+    }
+    if (!size)
+	return 0;
+
+    if (!(fr = calloc(1, sizeof(*fr))))
+	return -1;
+    for (nbuckets = 1; nbuckets < size; nbuckets *= 2)
+	;
+    if (!(fr->table = calloc(nbuckets, sizeof(*fr->table)))) {
+	free(fr);
+	return -1;
+    }
+    fr->mask = nbuckets - 1;
+    fr->max = size;
+    ctx->fragments = fr;
+    return 0;
+}
 
 /*
  * A function to print a partially decoded string. Meaningful bits for
  * "flags" are the output mask etc. These bits get saved in the data
  * structure. 
  */
-int Barcode_Print(struct Barcode_Item *bc, FILE *f, int flags)
+int Barcode_Print_Sink(struct Barcode_Item *bc, struct Barcode_Sink *sink,
+		       int flags)
 {
     int validbits = BARCODE_OUTPUT_MASK | BARCODE_NO_ASCII
-	| BARCODE_OUT_NOHEADERS;
+	| BARCODE_OUT_NOHEADERS | BARCODE_OUT_STREAMING
+	| BARCODE_OUT_NOCOMMENTS;
+    struct Barcode_Backend *backend;
+    int retval;
 
     /* If any flag is clear in "flags", inherit it from "bc->flags" */
     if (!(flags & BARCODE_OUTPUT_MASK))
@@ -197,13 +2240,148 @@ int Barcode_Print(struct Barcode_Item *bc, FILE *f, int flags)
 	flags |= bc->flags & BARCODE_NO_ASCII;
     if (!(flags & BARCODE_OUT_NOHEADERS))
 	flags |= bc->flags & BARCODE_OUT_NOHEADERS;
+    if (!(flags & BARCODE_OUT_STREAMING))
+	flags |= bc->flags & BARCODE_OUT_STREAMING;
+    if (!(flags & BARCODE_OUT_NOCOMMENTS))
+	flags |= bc->flags & BARCODE_OUT_NOCOMMENTS;
     flags = bc->flags = (flags & validbits) | (bc->flags & ~validbits);
+    bc->errpos = -1;
+
+    backend = Barcode_backend(flags);
+    /* only an item that draws nothing but itself can be moved */
+    if (bc->context && bc->context->fragments && backend->relocate
+	&& !(flags & BARCODE_OUT_STREAMING)
+	&& (flags & BARCODE_OUT_NOHEADERS || !backend->begin_document))
+	retval = Barcode_print_fragment(bc, backend, sink);
+    else
+	retval = backend->draw_item(bc, sink);
+    if (retval < 0)
+	return -1;
+    if (Barcode_Sink_Flush(sink) < 0) {
+	bc->error = sink->error;
+	return -1;
+    }
+    return 0;
+}
+
+int Barcode_Print(struct Barcode_Item *bc, FILE *f, int flags)
+{
+    struct Barcode_Sink sink;
+
+    Barcode_Sink_Init(&sink, Barcode_file_write, f);
+    return Barcode_Print_Sink(bc, &sink, flags);
+}
+
+/*
+ * Print to memory, without a FILE. If the output doesn't fit, it is
+ * still measured, and the state of the stream in the context (page,
+ * fonts and cursor) is left as it was: the layout of the item is
+ * kept, so printing again with a buffer big enough gives exactly that
+ * size. Fragments and counters are kept too, as they describe items
+ * that were rendered anyway
+ */
+int Barcode_Print_Buffer(struct Barcode_Item *bc, char *buf, size_t cap,
+			 int flags)
+{
+    struct Barcode_buffer b = {buf, cap, 0};
+    struct Barcode_Sink sink;
+    struct Barcode_Context *ctx = bc->context;
+    double psfont = 0, pclfont = 0, pclx = 0, pcly = 0;
+    int page = 0, pclfontid = 0, pclcursor = 0;
+
+    if (ctx) {
+	page = ctx->page;
+	psfont = ctx->psfont;
+	pclfont = ctx->pclfont;
+	pclfontid = ctx->pclfontid;
+	pclcursor = ctx->pclcursor;
+	pclx = ctx->pclx;
+	pcly = ctx->pcly;
+    }
+    Barcode_Sink_Init(&sink, Barcode_buffer_write, &b);
+    if (Barcode_Print_Sink(bc, &sink, flags) < 0)
+	return -1;
+    if (b.used > cap && ctx) {
+	ctx->page = page;
+	ctx->psfont = psfont;
+	ctx->pclfont = pclfont;
+	ctx->pclfontid = pclfontid;
+	ctx->pclcursor = pclcursor;
+	ctx->pclx = pclx;
+	ctx->pcly = pcly;
+    }
+    return b.used;
+}
 
-    if (bc->flags & BARCODE_OUT_PCL)
-       return Barcode_pcl_print(bc, f);
-    if (bc->flags & BARCODE_OUT_SVG)
-       return Barcode_svg_print(bc, f);
-    return Barcode_ps_print(bc, f);
+/*
+ * Print to "n" streams in turn. The output flags of each one replace
+ * those of the item, instead of inheriting them from the previous one,
+ * and the item is printed as if it belonged to the context of the
+ * stream. The encoding flags and the layout don't change, so they are
+ * shared by all of them. The item gets its flags and its context back.
+ * Returns 0, or -1 at the first stream that fails (with bc->error set)
+ */
+int Barcode_Print_Outputs(struct Barcode_Item *bc,
+			  struct Barcode_Output *out, int n)
+{
+    int outbits = BARCODE_OUTPUT_MASK | BARCODE_OUT_NOHEADERS
+	| BARCODE_OUT_STREAMING | BARCODE_OUT_NOCOMMENTS;
+    struct Barcode_Context *ctx = bc->context;
+    int flags = bc->flags, i, retval = 0;
+
+    for (i = 0; i < n && retval == 0; i++) {
+	bc->flags = flags & ~outbits;
+	bc->context = out[i].context;
+	retval = Barcode_Print(bc, out[i].f, out[i].flags);
+    }
+    bc->flags = flags;
+    bc->context = ctx;
+    return retval;
+}
+
+/*
+ * Documents and pages, for the output type in ctx->flags. The missing
+ * hooks are just skipped. Beginning a page also resets the state of
+ * the context (see Barcode_Context_Page).
+ */
+static int Barcode_document(struct Barcode_Context *ctx, FILE *f,
+			    int (*hook)(struct Barcode_Context *ctx,
+					struct Barcode_Sink *f))
+{
+    struct Barcode_Sink sink;
+
+    if (!hook)
+	return 0;
+    Barcode_Sink_Init(&sink, Barcode_file_write, f);
+    if (hook(ctx, &sink) < 0)
+	return -1;
+    if (Barcode_Sink_Flush(&sink) < 0) {
+	errno = sink.error;
+	return -1;
+    }
+    return 0;
+}
+
+int Barcode_Begin_Document(struct Barcode_Context *ctx, FILE *f)
+{
+    ctx->page = 0;
+    return Barcode_document(ctx, f, Barcode_backend(ctx->flags)->begin_document);
+}
+
+int Barcode_Begin_Page(struct Barcode_Context *ctx, FILE *f)
+{
+    Barcode_Context_Page(ctx);
+    return Barcode_document(ctx, f, Barcode_backend(ctx->flags)->begin_page);
+}
+
+int Barcode_End_Page(struct Barcode_Context *ctx, FILE *f)
+{
+    return Barcode_document(ctx, f, Barcode_backend(ctx->flags)->end_page);
+}
+
+int Barcode_End_Document(struct Barcode_Context *ctx, FILE *f)
+{
+    return Barcode_document(ctx, f, Barcode_backend(ctx->flags)->end_document);
 }
 
 /*
@@ -25,6 +25,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "cmdline.h"
 
@@ -93,7 +98,7 @@ int encode_id(char *encode_name)
     for (i = 0;  encode_tab[i].name; i++)
 	if (!strcasecmp(encode_tab[i].name, encode_name))
 	    return encode_tab[i].type;
-    return -1;
+    return Barcode_Encoding_Type(encode_name); /* maybe from a plugin */
 }
 
 int list_encodes(FILE *f) /* used in the help message */
@@ -110,6 +115,10 @@ int list_encodes(FILE *f) /* used in the help message */
 	fprintf(f, "\"%s\"", encode_tab[i].name);
 	prev = encode_tab[i].type;
     }
+    /* and the ones registered by plugins */
+    for (i = BARCODE_39EXT + 1; i <= BARCODE_ENCODING_MASK; i++)
+	if (Barcode_Encoding_Name(i))
+	    fprintf(f, "\n\t\"%s\"", Barcode_Encoding_Name(i));
     fprintf(f, "\n");
     return 0;
 }
@@ -126,10 +135,24 @@ int lines, columns;                   /* "-t" for tables */
 int xmargin0, ymargin0;               /* both for "-g" and "-t" */
 int xmargin1, ymargin1;               /* same, but right and top */
 int ximargin, yimargin;               /* "-m": internal margins */
-int eps, svg, pcl, ps, noascii, nochecksum; /* boolean flags */
+int eps, svg, pcl, noascii, nochecksum; /* boolean flags */
+int streaming;                        /* "-s": PCL streaming mode */
+int measure;                          /* "-M": only print the dimensions */
+int check;                            /* "-C": only verify the input */
+int shortest;                         /* "-O": fewest code 128 symbols */
+int nocomments;                       /* "-q": no informative comments */
 int page_wid, page_hei;               /* page size in points */
 char *page_name;                      /* name of the media */
 double unit = 1.0;                    /* unit specification */
+char *cachedir;                       /* "-d": keep the output there */
+size_t cachesize = 64 << 20;          /* and use up to 64MB by default */
+
+#define MAX_OUTPUTS 8
+struct output_file {
+    char *filename;
+    int flags;                        /* the format, from the prefix */
+} outputs[MAX_OUTPUTS];               /* "-o fmt:file": more output files */
+int noutputs;
 
 char *prgname;  /* used to print error msgs, initialized to argv[0] by main */
 
@@ -139,18 +162,20 @@ char *prgname;  /* used to print error msgs, initialized to argv[0] by main */
 
 struct encode_item {
     char *string;
+    struct Barcode_Range *range; /* "-r": the strings are generated */
     struct encode_item *next;
 } *list_head, *list_tail;
 
-/* each "-b" option adds a string to the input pool allocating its space */
-int get_input_string(void *arg)
+/* add an item to the input pool, in command line order */
+struct encode_item *add_input_item(void)
 {
     struct encode_item *item = malloc(sizeof(*item));
     if (!item) {
 	fprintf(stderr, "%s: malloc: %s\n", prgname, strerror(errno));
-	return -2;
+	return NULL;
     }
-    item->string = strdup(arg);
+    item->string = NULL;
+    item->range = NULL;
     if (!list_head) {
 	list_head = list_tail = item;
     } else {
@@ -158,33 +183,125 @@ int get_input_string(void *arg)
 	list_tail = item;
     }
     item->next = NULL;
+    return item;
+}
+
+/* each "-b" option adds a string to the input pool allocating its space */
+int get_input_string(void *arg)
+{
+    struct encode_item *item = add_input_item();
+    if (!item)
+	return -2;
+    item->string = strdup(arg);
     return 0;
 }
 
+/*
+ * each "-r" option adds a range: <format>:<start>:<end>[:<step>[:<check>]],
+ * where the format has one "%d" (with flags), and the check is the
+ * encoding whose check digit is appended ("ean", "upc" or "isbn")
+ */
+int get_range(void *arg)
+{
+    struct encode_item *item;
+    struct Barcode_Range *range;
+    char *spec = strdup((char *)arg), *s, *end;
+    unsigned long first, last;
+    long step = 1;
+    int check = 0;
+
+    /* the format ends at the first colon after the conversion */
+    for (s = spec; s && (s = strchr(s, '%')) && s[1] == '%'; s += 2)
+	;
+    if (!s || !(s = strchr(s, ':')))
+	goto wrong;
+    *s++ = '\0';
+    first = strtoul(s, &end, 0);
+    if (end == s || *end != ':')
+	goto wrong;
+    s = end + 1;
+    last = strtoul(s, &end, 0);
+    if (end == s || (*end && *end != ':'))
+	goto wrong;
+    if (*end) {
+	s = end + 1;
+	step = strtol(s, &end, 0);
+	if (end == s || (*end && *end != ':'))
+	    goto wrong;
+	if (*end) {
+	    check = encode_id(end + 1);
+	    if (check != BARCODE_EAN && check != BARCODE_UPC
+		&& check != BARCODE_ISBN)
+		goto wrong;
+	}
+    }
+    range = Barcode_Range_Create(spec, first, last, step, check);
+    if (!range)
+	goto wrong;
+    free(spec);
+    if (!(item = add_input_item())) {
+	Barcode_Range_Delete(range);
+	return -2;
+    }
+    item->range = range;
+    return 0;
+
+ wrong:
+    fprintf(stderr, _("%s: wrong range specification \"%s\"\n"), prgname,
+	    (char *)arg);
+    free(spec);
+    return -2;
+}
+
 /* and this function extracts strings from the pool */
 char *retrieve_input_string(FILE *ifile)
 {
-    char *string;
-    static char fileline[128];
+    char *string, *new;
+    static char *fileline;
+    static size_t filesize;
+    size_t len = 0;
 
-    struct encode_item *item = list_head;
-    if (list_tail) { /* this means at least one "-b" was specified */
-	if (!item)
-	    return NULL; /* the list is empty */
-	string = item->string;
-	list_head = item->next;
-	free(item);
-	return string;
+    struct encode_item *item;
+    if (list_tail) { /* this means at least one "-b" or "-r" was specified */
+	while ((item = list_head)) {
+	    if (item->range && (string = Barcode_Range_Next(item->range)))
+		return string; /* the library copies it, like the line */
+	    if (item->range)
+		Barcode_Range_Delete(item->range);
+	    string = item->string;
+	    list_head = item->next;
+	    free(item);
+	    if (string)
+		return string;
+	}
+	return NULL; /* the list is empty */
     }
 
-    /* else,  read from the file */
-    if (!fgets(fileline, 128, ifile))
-	return NULL;
-    if (fileline[strlen(fileline)-1]=='\n')
-	fileline[strlen(fileline)-1]= '\0';
-    if (fileline[strlen(fileline)-1]=='\r')
-	fileline[strlen(fileline)-1]= '\0';
-    return strdup(fileline);
+    /*
+     * else,  read from the file: a line of any length, as "-C" splits
+     * the input only at the newlines too
+     */
+    do {
+	if (filesize - len < 2) {
+	    if (!(new = realloc(fileline, filesize ? 2 * filesize : 128))) {
+		fprintf(stderr, "%s: realloc: %s\n", prgname, strerror(errno));
+		exit(1);
+	    }
+	    fileline = new;
+	    filesize = filesize ? 2 * filesize : 128;
+	}
+	if (!fgets(fileline + len, filesize - len, ifile)) {
+	    if (!len)
+		return NULL;
+	    break; /* the last line, without a newline */
+	}
+	len += strlen(fileline + len);
+    } while (len && fileline[len-1] != '\n');
+    if (len && fileline[len-1]=='\n')
+	fileline[--len]= '\0';
+    if (len && fileline[len-1]=='\r')
+	fileline[--len]= '\0';
+    return fileline; /* the library copies it, no need to strdup */
 }
 
 /* accept a unit specification */
@@ -298,6 +415,71 @@ int get_margin(void *arg)
     return 0;
 }
 
+/* the cache directory, maybe followed by its size in megabytes */
+int get_cache(void *arg)
+{
+    char *s = strrchr((char *)arg, ',');
+    char *end;
+    long mb;
+
+    cachedir = strdup((char *)arg);
+    if (s) {
+	mb = strtol(s + 1, &end, 10);
+	if (end == s + 1 || *end || mb < 0) {
+	    fprintf(stderr, _("%s: wrong cache specification \"%s\"\n"),
+		    prgname, (char *)arg);
+	    return -2;
+	}
+	cachedir[s - (char *)arg] = '\0';
+	cachesize = (size_t)mb << 20;
+    }
+    return 0;
+}
+
+/*
+ * "-o" is the output file, in the format chosen by -E, -S or -P, unless
+ * it begins with the name of a format and a colon: then it is one more
+ * file, that gets the same codes in that format
+ */
+struct {
+    char *name;
+    int flags;
+} output_tab[] = {
+    {"ps",  BARCODE_OUT_PS | BARCODE_OUT_NOHEADERS},
+    {"eps", BARCODE_OUT_EPS},
+    {"svg", BARCODE_OUT_SVG},
+    {"pcl", BARCODE_OUT_PCL},
+    {NULL, 0}
+};
+
+/* EPS and SVG files hold one code only */
+int one_code(int flags)
+{
+    flags &= BARCODE_OUTPUT_MASK;
+    return flags == BARCODE_OUT_EPS || flags == BARCODE_OUT_SVG;
+}
+
+int get_output(void *arg)
+{
+    char *s = strchr((char *)arg, ':');
+    int i;
+
+    for (i = 0; s && output_tab[i].name; i++) {
+	if (strlen(output_tab[i].name) != s - (char *)arg
+	    || strncmp(output_tab[i].name, arg, s - (char *)arg))
+	    continue;
+	if (noutputs == MAX_OUTPUTS) {
+	    fprintf(stderr, _("%s: too many output files\n"), prgname);
+	    return -2;
+	}
+	outputs[noutputs].filename = s + 1;
+	outputs[noutputs++].flags = output_tab[i].flags;
+	return 0;
+    }
+    ofilename = arg;
+    return 0;
+}
+
 /* convert a page geometry specification */
 int get_page_geometry(void *arg)
 {
@@ -378,8 +560,8 @@ int get_page_geometry(void *arg)
 struct commandline option_table[] = {
     {'i', CMDLINE_S, &ifilename, NULL, NULL, NULL,
      _N ("input file (strings to encode), default is stdin")},
-    {'o', CMDLINE_S, &ofilename, NULL, NULL, NULL,
-        _N ("output file, default is stdout")},
+    {'o', CMDLINE_S, NULL, get_output, NULL, NULL,
+        _N ("output file, default is stdout, or more: <fmt>:<file>")},
     {'b', CMDLINE_S, NULL, get_input_string, NULL, NULL,
         _N ("string to encode (use input file if missing)")},
     {'e', CMDLINE_S, NULL, get_encoding, "BARCODE_ENCODING", NULL,
@@ -406,9 +588,178 @@ struct commandline option_table[] = {
      _N ("page size (refer to the man page)")},
     {'s', CMDLINE_NONE, &streaming, NULL, NULL, 0,
      _N ("streaming mode (refer to the man page)")},
+    {'d', CMDLINE_S, NULL, get_cache, "BARCODE_CACHE", NULL,
+     _N ("keep the output in a directory, for later runs: <dir>[,<MB>]")},
+    {'r', CMDLINE_S, NULL, get_range, NULL, NULL,
+     _N ("strings to encode: <fmt>:<first>:<last>[:<step>[:<check>]]")},
+    {'M', CMDLINE_NONE, &measure, NULL, NULL, NULL,
+     _N ("\"measure\": print the dimensions of each code, not the code")},
+    {'q', CMDLINE_NONE, &nocomments, NULL, NULL, NULL,
+     _N ("\"quiet\": no informative comments in PS and SVG output")},
+    {'C', CMDLINE_NONE, &check, NULL, NULL, NULL,
+     _N ("\"check\": report the lines that can't be encoded, print nothing")},
+    {'O', CMDLINE_NONE, &shortest, NULL, NULL, NULL,
+     _N ("\"optimize\": code 128 with the fewest symbols")},
     {0,}
 };
 
+/*
+ * Check mode: the texts are verified in chunks, with as many threads
+ * as the library wants, and only the wrong ones are reported, one per
+ * line: the line number, the char (from 1, or 0 if no char is to
+ * blame), the reason and the text
+ */
+#define CHECK_CHUNK 65536
+
+static char *check_texts[CHECK_CHUNK];
+static int check_errors[CHECK_CHUNK], check_errpos[CHECK_CHUNK];
+
+unsigned long check_chunk(FILE *f, int n, unsigned long first, int flags)
+{
+    unsigned long wrong;
+    char *reason;
+    int i;
+
+    wrong = Barcode_Verify_Batch(check_texts, n, flags, 0,
+				 check_errors, check_errpos);
+    for (i = 0; wrong && i < n; i++) {
+	if (!check_errors[i])
+	    continue;
+	if (check_errors[i] != EINVAL)
+	    reason = strerror(check_errors[i]);
+	else if (check_errpos[i] < 0)
+	    reason = flags & BARCODE_ENCODING_MASK ? "rejected" : "no-encoding";
+	else if (check_errpos[i] < strlen(check_texts[i]))
+	    reason = "invalid-char";
+	else
+	    reason = "invalid-length";
+	fprintf(f, "%lu\t%i\t%s\t%s\n", first + i, check_errpos[i] + 1,
+		reason, check_texts[i]);
+    }
+    return wrong;
+}
+
+/* the whole stream, when it can't be mapped: a pipe, for example */
+char *check_read(FILE *ifile, size_t *size)
+{
+    char *buf = NULL, *new;
+    size_t len = 0, n;
+
+    do {
+	if (!(new = realloc(buf, len + 65536))) {
+	    free(buf);
+	    return NULL;
+	}
+	buf = new;
+	len += n = fread(buf + len, 1, 65536, ifile);
+    } while (n);
+    *size = len;
+    return buf;
+}
+
+/* verify all the input, and count the wrong texts; -1 if out of memory */
+int check_input(FILE *ifile, FILE *f, int flags, unsigned long *wrong)
+{
+    char *buf = NULL, *s, *end, *nl, *last = NULL, *line;
+    size_t size = 0;
+    unsigned long first = 1;
+    int i, n = 0, mapped = 0;
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+#endif
+
+    *wrong = 0;
+    fprintf(f, "#line\tchar\treason\ttext\n");
+    if (list_tail) { /* "-b" and "-r": numbered as they come */
+	while ((line = retrieve_input_string(ifile))) {
+	    if (!(check_texts[n++] = strdup(line)))
+		return -1;
+	    if (n < CHECK_CHUNK)
+		continue;
+	    *wrong += check_chunk(f, n, first, flags);
+	    for (i = 0; i < n; i++)
+		free(check_texts[i]);
+	    first += n;
+	    n = 0;
+	}
+	*wrong += check_chunk(f, n, first, flags);
+	for (i = 0; i < n; i++)
+	    free(check_texts[i]);
+	return 0;
+    }
+
+    /*
+     * A file is mapped privately, so the lines can be terminated in
+     * place; only the last one may need a copy, if it has no newline
+     */
+#ifdef HAVE_SYS_MMAN_H
+    if (fstat(fileno(ifile), &st) == 0 && S_ISREG(st.st_mode)
+	&& st.st_size > 0) {
+	size = st.st_size;
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fileno(ifile), 0);
+	if (buf == MAP_FAILED)
+	    buf = NULL;
+	else
+	    mapped = 1;
+    }
+#endif
+    if (!buf && !(buf = check_read(ifile, &size)))
+	return -1;
+
+    for (s = buf, end = buf + size; s < end; s = nl + 1) {
+	if (!(nl = memchr(s, '\n', end - s))) {
+	    if (!(last = malloc(end - s + 1)))
+		return -1;
+	    memcpy(last, s, end - s);
+	    last[end - s] = '\0';
+	    check_texts[n++] = last;
+	    break;
+	}
+	*nl = '\0';
+	if (nl > s && nl[-1] == '\r')
+	    nl[-1] = '\0';
+	check_texts[n++] = s;
+	if (n == CHECK_CHUNK) {
+	    *wrong += check_chunk(f, n, first, flags);
+	    first += n;
+	    n = 0;
+	}
+    }
+    *wrong += check_chunk(f, n, first, flags);
+
+    free(last);
+#ifdef HAVE_SYS_MMAN_H
+    if (mapped) {
+	munmap(buf, size);
+	return 0;
+    }
+#endif
+    free(buf);
+    return 0;
+}
+
+/*
+ * Load the extra encodings listed in BARCODE_PLUGINS (colon-separated
+ * shared objects). This must happen before "-e" is parsed.
+ */
+void load_plugins(void)
+{
+    char *list, *path;
+
+    if (!getenv("BARCODE_PLUGINS"))
+	return;
+    list = strdup(getenv("BARCODE_PLUGINS"));
+    for (path = strtok(list, ":"); path; path = strtok(NULL, ":")) {
+	if (Barcode_Load_Encodings(path) < 0) {
+      fprintf(stderr, _("%s: can't load encodings from \"%s\": %s\n"),
+		    prgname, path, strerror(errno));
+	    exit(1);
+	}
+    }
+    free(list);
+}
+
 #ifdef NO_STRERROR
 /*
  * A strerror replacement (thanks to Thad Floryan <thad@thadlabs.com>)
@@ -428,15 +779,22 @@ char *strerror(int error)
  */
 int main(int argc, char **argv)
 {
+    struct Barcode_Context *ctx;
     struct Barcode_Item * bc;
+    struct Barcode_Output out[MAX_OUTPUTS + 1];
     FILE *ifile = stdin;
     FILE *ofile = stdout;
     char *line;
     int flags=0; /* for the library */
-    int page, retval;
+    int outbits = BARCODE_OUTPUT_MASK | BARCODE_OUT_NOHEADERS
+	| BARCODE_OUT_STREAMING | BARCODE_OUT_NOCOMMENTS;
+    int retval;
     int errors = 0;
+    int i, nout = 0, haspcl, single = 0;
+    unsigned long reused = 0, drawn = 0, loaded = 0;
 
     prgname = argv[0];
+    load_plugins();
 #define SHOW_VERSION() \
     printf (_("GNU barcode %s is a tool to convert text strings to printed bars.\n"), PACKAGE_VERSION); \
     printf("\n");
@@ -482,7 +840,10 @@ int main(int argc, char **argv)
 #endif
     }
 
-    if (!pcl && streaming) {
+    for (i = 0, haspcl = pcl; i < noutputs; i++)
+	if (outputs[i].flags & BARCODE_OUT_PCL)
+	    haspcl = 1;
+    if (!haspcl && streaming) {
       fprintf(stderr, _("Streaming is only implemented for PCL mode\n"));
 	exit(1);
     }	
@@ -519,7 +880,6 @@ int main(int argc, char **argv)
     if (pcl) {
 	flags |= BARCODE_OUT_PCL;
     } else {
-	ps = !(eps || svg); /* a shortcut */
 	if (eps)
 	    flags |= BARCODE_OUT_EPS; /* print headers too */
         else if (svg)
@@ -531,48 +891,157 @@ int main(int argc, char **argv)
 	flags |= BARCODE_NO_ASCII;
     if (nochecksum)
 	flags |= BARCODE_NO_CHECKSUM;
+    if (shortest)
+	flags |= BARCODE_SHORTEST;
+    if (streaming)
+	flags |= BARCODE_OUT_STREAMING;
+    if (nocomments)
+	flags |= BARCODE_OUT_NOCOMMENTS;
+
+    /* in check mode nothing is printed, only the wrong texts are told */
+    if (check) {
+	unsigned long wrong;
+
+	if (check_input(ifile, ofile, flags, &wrong) < 0) {
+	    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	    exit(1);
+	}
+	return wrong ? 1 : 0;
+    }
+
+    /*
+     * The output streams: the main one, unless only "-o fmt:file" was
+     * used, and then those files, with the same output options
+     */
+    if (ofilename || !noutputs) {
+	out[nout].f = ofile;
+	out[nout++].flags = flags & outbits;
+    }
+    for (i = 0; i < noutputs; i++, nout++) {
+	out[nout].f = fopen(outputs[i].filename, "w");
+	if (!out[nout].f) {
+	    fprintf(stderr, "%s: %s: %s\n", argv[0], outputs[i].filename,
+		    strerror(errno));
+	    exit(1);
+	}
+	out[nout].flags = outputs[i].flags;
+	if (streaming && (outputs[i].flags & BARCODE_OUT_PCL))
+	    out[nout].flags |= BARCODE_OUT_STREAMING;
+	if (nocomments)
+	    out[nout].flags |= BARCODE_OUT_NOCOMMENTS;
+    }
+    for (i = 0; i < nout; i++)
+	single |= one_code(out[i].flags);
 
     /* the table is not available in eps mode */
-    if ((eps || svg) && (lines>1 || columns>1)) {
+    if (single && (lines>1 || columns>1)) {
       fprintf(stderr, _("%s: can't print tables in EPS format\n"),argv[0]);
 	exit(1);
     }
 
-    if (ps) { /* The header is independent of single/table mode */
-	/* Headers. Don't let the library do it, we may need multi-page */
-	fprintf(ofile, "%%!PS-Adobe-2.0\n");
-	/* It would be nice to know the bounding box. Leave it alone */
-	fprintf(ofile, "%%%%Creator: \"barcode\", "
-		"libbarcode sample frontend\n");
-	if (page_name)
-	    fprintf(ofile, "%%%%DocumentPaperSizes: %s\n", page_name);
-	fprintf(ofile, "%%%%EndComments\n");
-	fprintf(ofile, "%%%%EndProlog\n\n");
+    /*
+     * All the codes go to the same stream: use a single context, that
+     * recycles the item and remembers the state of the printer. With
+     * more streams, each one has its own context, but the codes are
+     * encoded once, with the first one, and printed to all of them
+     */
+    for (i = 0; i < nout; i++) {
+	out[i].context = Barcode_Context_Create((flags & ~outbits)
+						| out[i].flags);
+	if (!out[i].context) {
+      fprintf(stderr, _("%s: Barcode_Context_Create(): %s\n"), argv[0],
+		    strerror(errno));
+	    exit(1);
+	}
+	out[i].context->creator = "\"barcode\", libbarcode sample frontend";
+	out[i].context->paper = page_name;
+
+	/*
+	 * The same code on a sheet is only drawn once: keep a page of
+	 * them. With a cache directory, they are kept for later runs too
+	 */
+	if (lines || columns)
+	    Barcode_Context_Fragments(out[i].context, lines * columns);
+	else if (cachedir)
+	    Barcode_Context_Fragments(out[i].context, 64);
+	if (cachedir && Barcode_Context_Cache_Dir(out[i].context, cachedir,
+						  cachesize) < 0) {
+      fprintf(stderr, "%s: %s: %s\n", argv[0], cachedir, strerror(errno));
+	    exit(1);
+	}
+    }
+    ctx = out[0].context;
+
+    /* serial numbers only differ at the end: encode just that */
+    Barcode_Context_Incremental(ctx, 1);
+
+    /*
+     * When measuring, each code is only encoded and laid out, as "-g"
+     * says, and a line of numbers is printed instead of the document
+     */
+    if (measure) {
+	struct Barcode_Measure m;
+
+	fprintf(out[0].f, "#barlen\tbars\tscale\twidth\theight\tmargin"
+		"\tboxwid\tboxhei\tbarx0\tbarx1\ttextx0\ttextx1"
+		"\ttexty0\ttexty1\ttextsize\ttext\n");
+	while ( (line = retrieve_input_string(ifile)) ) {
+	    bc = Barcode_Reset(ctx, line);
+	    if (!bc
+		|| Barcode_Position(bc, code_width, code_height,
+				    xmargin0, ymargin0, 0.0) < 0
+		|| Barcode_Measure(bc, flags, &m) < 0) {
+		if (bc && bc->errpos >= 0)
+        fprintf(stderr, _("%s: can't encode \"%s\" (at char %i)\n"),
+			argv[0], line, bc->errpos + 1);
+		else
+        fprintf(stderr, _("%s: can't encode \"%s\"\n"), argv[0], line);
+		errors++;
+		continue;
+	    }
+	    fprintf(out[0].f, "%i\t%i\t%g\t%i\t%i\t%i\t%i\t%i"
+		    "\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%s\n",
+		    m.barlen, m.nbars, m.scale, m.width, m.height, m.margin,
+		    m.boxwidth, m.boxheight, m.barx0, m.barx1,
+		    m.textx0, m.textx1, m.texty0, m.texty1, m.textsize, line);
+	}
+	for (i = 0; i < nout; i++)
+	    Barcode_Context_Delete(out[i].context);
+	return errors ? 1 : 0;
     }
 
+    /*
+     * The header is independent of single/table mode. Don't let the
+     * library print it with each code, we may need multi-page
+     */
+    for (i = 0; i < nout; i++)
+	Barcode_Begin_Document(out[i].context, out[i].f);
+
     /*
      * Here we are, ready to work. Handle the one-per-page case first,
      * as it is shorter.
      */
     if (!lines && !columns) {
-	page = 0;
 	while ( (line = retrieve_input_string(ifile)) ) {
-	    page++;
-	    if (ps) {
-		fprintf(ofile, "%%%%Page: %i %i\n\n",page,page);
-	    }
-	    if (Barcode_Encode_and_Print(line, ofile, code_width, code_height,
-					 xmargin0, ymargin0, flags) < 0) {
+	    for (i = 0; i < nout; i++)
+		Barcode_Begin_Page(out[i].context, out[i].f);
+	    bc = Barcode_Reset(ctx, line);
+	    if (!bc
+		|| Barcode_Position(bc, code_width, code_height,
+				    xmargin0, ymargin0, 0.0) < 0
+		|| Barcode_Encode(bc, flags) < 0
+		|| Barcode_Print_Outputs(bc, out, nout) < 0) {
+		if (bc && bc->errpos >= 0) /* counted from 1, for humans */
+        fprintf(stderr, _("%s: can't encode \"%s\" (at char %i)\n"),
+			argv[0], line, bc->errpos + 1);
+		else
         fprintf(stderr, _("%s: can't encode \"%s\"\n"), argv[0], line);
 		errors++;
 	    }
-	    if (eps || svg) break; /* if output is eps, do it once only */
-	    if (ps) fprintf(ofile, "showpage\n");
-	    if (pcl && !streaming) fprintf(ofile, "\f");
-	}
-	/* no more lines, print footers */
-	if (ps) {
-	    fprintf(ofile, "%%%%Trailer\n\n");
+	    for (i = 0; i < nout; i++)
+		if (!one_code(out[i].flags))
+		    Barcode_End_Page(out[i].context, out[i].f);
+	    if (single) break; /* if output is eps, do it once only */
 	}
     } else {
 
@@ -590,29 +1059,28 @@ int main(int argc, char **argv)
 	    code_height = ystep - 2*yimargin;
 	}
 
-	page=0;
 	while ( (line = retrieve_input_string(ifile)) ) {
 	    x++;  /* fit x and y */
 	    if (x >= columns) {
 		x=0; y--;
 		if (y<0) {
-		    y = lines-1; page++;
+		    y = lines-1;
 		    /* flush page */
-		    if (ps && page > 1) fprintf(ofile, "showpage\n");
-		    if (pcl && page > 1) fprintf(ofile, "\f");
-		    /* new page */
-		    if (ps) fprintf(ofile, "%%%%Page: %i %i\n\n",page,page);
+		    for (i = 0; i < nout; i++) {
+			if (out[i].context->page)
+			    Barcode_End_Page(out[i].context, out[i].f);
+			Barcode_Begin_Page(out[i].context, out[i].f);
+		    }
 		}
 	    }
 
 	    /*
-	     * Create a barcode item. This allows to set the margin to 0, as
-	     * we have [xy]imargin to use. But don't use Encode_and_Print(),
-	     * unroll it here instead
+	     * Reset the barcode item. This allows to set the margin to 0, as
+	     * we have [xy]imargin to use.
 	     */
-	    bc = Barcode_Create(line);
+	    bc = Barcode_Reset(ctx, line);
 	    if (!bc) {
-      fprintf(stderr, _("%s: Barcode_Create(): %s\n"), argv[0],
+      fprintf(stderr, _("%s: Barcode_Reset(): %s\n"), argv[0],
 			strerror(errno));
 		exit(1);
 	    }
@@ -621,14 +1089,34 @@ int main(int argc, char **argv)
 				   xmargin0 + ximargin + x * xstep,
 				   ymargin0 + yimargin + y * ystep, 0.0) < 0)
 		 || (Barcode_Encode(bc, flags) < 0)
-		 || (Barcode_Print(bc, ofile, flags) < 0) ) {
+		 || (Barcode_Print_Outputs(bc, out, nout) < 0) ) {
+		if (bc->errpos >= 0)
+      fprintf(stderr, _("%s: can't encode \"%s\": %s (at char %i)\n"),
+			argv[0], line, strerror(bc->error), bc->errpos + 1);
+		else
       fprintf(stderr, _("%s: can't encode \"%s\": %s\n"), argv[0],
 			line, strerror(bc->error));
 	    }
-	    Barcode_Delete(bc);
 	}
-	if (ps) fprintf(ofile, "showpage\n\n%%%%Trailer\n\n");
-	if (pcl) fprintf(ofile, "\f");
+	for (i = 0; i < nout; i++)
+	    Barcode_End_Page(out[i].context, out[i].f);
+    }
+    /* no more lines, print footers */
+    for (i = 0; i < nout; i++) {
+	Barcode_End_Document(out[i].context, out[i].f);
+	reused += out[i].context->reused;
+	drawn += out[i].context->drawn;
+	loaded += out[i].context->loaded;
+    }
+    if (cachedir)
+      fprintf(stderr, _("%s: %lu codes reused out of %lu, %lu of them from %s\n"),
+		argv[0], reused, reused + drawn, loaded, cachedir);
+    for (i = 0; i < nout; i++) {
+	Barcode_Context_Delete(out[i].context);
+	if (out[i].f != stdout && fclose(out[i].f) != 0) {
+	    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	    errors++;
+	}
     }
     return errors ? 1 : 0;
 }
@@ -34,52 +34,38 @@ static char *fillers[] = { "031", "131" };
 static int width = 16 /* each character uses 4 patterns */,
 	startpos = 6 /* length of the first filler */;
 
+/* the verify function checks the text by encoding it */
+int Barcode_msi_encode(struct Barcode_Item *bc);
+
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  */
 int Barcode_msi_verify(char *text)
 {
-    int i;
-
-    if (!strlen(text))
-	return -1;
-    for (i=0; text[i]; i++) {
-        if (!isdigit(text[i]))
-            return -1;
-    }
-    return 0;
+    return Barcode_verify_text(text, Barcode_msi_encode);
 }
 
-static int add_one(char *ptr, int code)
+/* one pattern per bit, the most significant first */
+static int add_one(struct Barcode_Item *bc, int code)
 {
-    sprintf(ptr, "%s%s%s%s", 
-	patterns[(code >> 3) & 1],
-	patterns[(code >> 2) & 1],
-	patterns[(code >> 1) & 1],
-	patterns[code & 1]);
+    int bit;
+
+    for (bit = 3; bit >= 0; bit--)
+	Barcode_add_runs(bc, patterns[(code >> bit) & 1], 0);
     return 0;
 }
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
+ * The encoding functions fills the "runs" and "glyphs" fields.
  * Lowercase chars are converted to uppercase
  */
 int Barcode_msi_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *ptr, *textptr;
-    int i, code, textpos, usesum, checksum = 0;
-
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
+    char *text;
+    int i, len, code, textpos, usesum, checksum = 0;
 
     if (!bc->encoding)
-	bc->encoding = strdup("msi");
+	bc->encoding = "msi";
 
     if ((bc->flags & BARCODE_NO_CHECKSUM))
 	usesum = 0;
@@ -87,35 +73,32 @@ int Barcode_msi_encode(struct Barcode_Item *bc)
 	usesum = 1;
 
     text = bc->ascii;
-
-    /* the partial code is head + 8 * (text + check) + tail + margin + term. */
-    partial = malloc( 3 + 8 * (strlen(text) + 1) + 3 + 2 );
-    if (!partial) {
-        bc->error = errno;
+    if (!text) {
+        bc->error = EINVAL;
         return -1;
     }
+    if (!(len = strlen(text)))
+        return Barcode_text_error(bc, 0);
 
-    /* the text information is at most "nnn:fff:c " * strlen +term */
-    textinfo = malloc(10*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
+    /* the runs are head + 8 * (text + check) + tail + margin. */
+    if (Barcode_alloc_runs(bc, 3 + 8 * (len + 1) + 3 + 1) < 0)
         return -1;
-    }
 
-    strcpy(partial, fillers[0]);
-    ptr = partial + strlen(partial);
-    textptr = textinfo;
+    /* one glyph per digit */
+    if (Barcode_alloc_glyphs(bc, len) < 0)
+        return -1;
+
+    Barcode_add_runs(bc, fillers[0], 0);
     textpos = startpos;
     
-    for (i=0; i<strlen(text); i++) {
+    for (i=0; i<len; i++) {
+        if (!isdigit(text[i]))
+            return Barcode_text_error(bc, i);
         code = text[i] - '0';
-        add_one(ptr, code);
-        sprintf(textptr, "%i:12:%c ", textpos, text[i]);
+        add_one(bc, code);
+        Barcode_add_glyph(bc, textpos, 12, text[i], 0);
         
         textpos += width; /* width of each code */
-        textptr += strlen(textptr);
-        ptr += strlen(ptr); 
 	if (usesum) {
 	/* For a code ...FEDCBA the checksum is computed
 	 * as the sum of digits of the number ...FDB plus
@@ -123,7 +106,7 @@ int Barcode_msi_encode(struct Barcode_Item *bc)
 	 * Which is equivalent to the sum of each digit of ...ECA doubled
 	 * plus carry.
 	 */
-	    if ((i ^ strlen(text)) & 1) {
+	    if ((i ^ len) & 1) {
 		/* a last digit, 2 away from last, etc. */
 		checksum += 2 * code + (2 * code) / 10;
 	    } else {
@@ -142,13 +125,10 @@ int Barcode_msi_encode(struct Barcode_Item *bc)
 	 */
 	checksum = (checksum + 9) / 10 * 10 - checksum;
 	/* fprintf(stderr, "Checksum: %d\n", checksum); */
-	add_one(ptr, checksum);
-	ptr += strlen(ptr);
+	add_one(bc, checksum);
     }
 
-    strcpy(ptr, fillers[1]);
-    bc->partial = partial;
-    bc->textinfo = textinfo;
+    Barcode_add_runs(bc, fillers[1], 0);
 
     return 0;
 }
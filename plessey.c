@@ -36,131 +36,100 @@ static char *fillers[] = { "031311331", "331311313" };
 
 static int width = 16, startpos = 16;
 
+/* the verify function checks the text by encoding it */
+int Barcode_pls_encode(struct Barcode_Item *bc);
+
 /*
  * Check that the text can be encoded. Returns 0 or -1.
  * If it's all lowecase convert to uppercase and accept it
  */
 int Barcode_pls_verify(char *text)
 {
-    int i, upper = 0, lower = 0;
-
-    if (!strlen(text))
-	return -1;
-    for (i=0; text[i]; i++) {
-        if (!strchr(alphabet,toupper(text[i])))
-            return -1;
-	if (isupper(text[i])) upper++;
-	if (islower(text[i])) lower++;
-    }
-    if (upper && lower)
-	return -1;
-    return 0;
+    return Barcode_verify_text(text, Barcode_pls_encode);
 }
 
-static int add_one(char *ptr, int code)
+/* one pattern per bit, the least significant first */
+static int add_one(struct Barcode_Item *bc, int code)
 {
-    sprintf(ptr, "%s%s%s%s", 
-	patterns[code & 1],
-	patterns[(code >> 1) & 1],
-	patterns[(code >> 2) & 1],
-	patterns[(code >> 3) & 1]
-    );
+    int bit;
+
+    for (bit = 0; bit < 4; bit++)
+	Barcode_add_runs(bc, patterns[(code >> bit) & 1], 0);
     return 0;
 }
 
 /*
- * The encoding functions fills the "partial" and "textinfo" fields.
+ * The encoding functions fills the "runs" and "glyphs" fields.
  * Lowercase chars are converted to uppercase
  */
 int Barcode_pls_encode(struct Barcode_Item *bc)
 {
-    static char *text;
-    static char *partial;  /* dynamic */
-    static char *textinfo; /* dynamic */
-    char *c, *ptr, *textptr;
+    char *text;
+    char *c;
     unsigned char *checkptr;
-    int i, code, textpos;
+    int i, len, code, textpos, upper = 0, lower = 0;
     static char check[9] = {1,1,1,1,0,1,0,0,1};
-    if (bc->partial)
-	free(bc->partial);
-    if (bc->textinfo)
-	free(bc->textinfo);
-    bc->partial = bc->textinfo = NULL; /* safe */
 
     if (!bc->encoding)
-	bc->encoding = strdup("plessey");
+	bc->encoding = "plessey";
 
     text = bc->ascii;
     if (!text) {
         bc->error = EINVAL;
         return -1;
     }
-    /* the partial code is 8 * (head + text + check + tail) + margin + term. */
-    partial = malloc( (strlen(text) + 4) * 8 + 3);
-    checkptr = calloc (1, strlen(text) * 4 + 8);
+    if (!(len = strlen(text)))
+        return Barcode_text_error(bc, 0);
+    /* the runs are 8 * (head + text + check + tail) + margin. */
+    if (Barcode_alloc_runs(bc, (len + 4) * 8 + 2) < 0)
+        return -1;
+    checkptr = Barcode_malloc(bc, len * 4 + 8);
 
-    if (!partial || !checkptr) {
-	if (partial) free(partial);
-	if (checkptr) free(checkptr);
+    if (!checkptr) {
         bc->error = errno;
         return -1;
     }
+    memset(checkptr, 0, len * 4 + 8);
 
-    /* the text information is at most "nnn:fff:c " * strlen +term */
-    textinfo = malloc(10*strlen(text) + 2);
-    if (!textinfo) {
-        bc->error = errno;
-        free(partial);
-        free(checkptr);
+    /* one glyph per char */
+    if (Barcode_alloc_glyphs(bc, len) < 0) {
+        Barcode_free(bc, checkptr);
         return -1;
     }
 
-    strcpy(partial, fillers[0]);
-    ptr = partial + strlen(partial);
-    textptr = textinfo;
+    Barcode_add_runs(bc, fillers[0], 0);
     textpos = startpos;
     
-    for (i=0; i<strlen(text); i++) {
+    for (i=0; i<len; i++) {
+        /* no mixed case: all lowercase is accepted, though */
+	if (isupper(text[i])) upper++;
+	if (islower(text[i])) lower++;
         c = strchr(alphabet, toupper(text[i]));
-        if (!c) {
-            bc->error = EINVAL; /* impossible if text is verified */
-            free(partial);
-            free(textinfo);
-            free(checkptr);
-            return -1;
+        if (!c || (upper && lower)) {
+            Barcode_free(bc, checkptr);
+            return Barcode_text_error(bc, i);
         }
         code = c - alphabet;
-        add_one(ptr, code);
-        sprintf(textptr, "%i:12:%c ", textpos, toupper(text[i]));
+        add_one(bc, code);
+        Barcode_add_glyph(bc, textpos, 12, toupper(text[i]), 0);
         
         textpos += width; /* width of each code */
-        textptr += strlen(textptr);
-        ptr += strlen(ptr); 
 	checkptr[4*i] = code & 1;
 	checkptr[4*i+1] = (code >> 1) & 1;
 	checkptr[4*i+2] = (code >> 2) & 1;
 	checkptr[4*i+3] = (code >> 3) & 1;
     }
     /* The CRC checksum is required */
-    for (i=0; i < 4*strlen(text); i++) {
+    for (i=0; i < 4*len; i++) {
         int j;
         if (checkptr[i])
                 for (j = 0; j < 9; j++)
                         checkptr[i+j] ^= check[j];
     }
-    for (i = 0; i < 8; i++) {
-        sprintf(ptr, patterns[checkptr[strlen(text) * 4 + i]]);
-	ptr += 2;
-    }
-    fprintf(stderr, _("CRC: "));
-    for (i = 0; i < 8; i++) {
-        fputc('0' + checkptr[strlen(text) * 4 + i], stderr);
-    }
-    fputc('\n', stderr);
-    strcpy(ptr, fillers[1]);
-    bc->partial = partial;
-    bc->textinfo = textinfo;
-    free(checkptr);
+    for (i = 0; i < 8; i++)
+        Barcode_add_runs(bc, patterns[checkptr[len * 4 + i]], 0);
+    Barcode_add_runs(bc, fillers[1], 0);
+    Barcode_free(bc, checkptr);
 
     return 0;
 }
@@ -0,0 +1,178 @@
+/*
+ * range.c -- generate the texts of a range of serial numbers
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+/*
+ * A range is a printf format with one integer conversion, and the
+ * numbers to print with it. The format given by the user is checked
+ * and rebuilt with a "long" conversion, so it is safe to pass it to
+ * sprintf; the text is built in a buffer that is reused for each one
+ */
+struct Barcode_Range {
+    char *format;      /* the one given, with 'l' before the conversion */
+    unsigned long next, end;
+    long step;
+    int check;         /* BARCODE_EAN, _UPC or _ISBN for a check digit */
+    int done;
+    char *buf;
+};
+
+#define RANGE_MAXWIDTH 64
+
+/*
+ * The check digit of the digits in "text": the 3-1 weights of EAN-13,
+ * EAN-8 and UPC-A, or the 10 to 2 weights of ISBN-10 (with 'X' for 10).
+ * Both count from the right, so they don't depend on the length
+ */
+static int Barcode_range_check(char *text, int len, int check)
+{
+    int i, sum = 0;
+
+    if (check == BARCODE_ISBN) {
+	for (i = 0; i < len; i++)
+	    sum += (len - i + 1) * (text[i] - '0');
+	sum = (11 - sum % 11) % 11;
+	return sum == 10 ? 'X' : '0' + sum;
+    }
+    for (i = 0; i < len; i++)
+	sum += ((len - i) % 2 ? 3 : 1) * (text[i] - '0');
+    return '0' + (10 - sum % 10) % 10;
+}
+
+/*
+ * Create a range from "start" to "end" (both included) with "step",
+ * that may be negative. The format has one conversion among "%d",
+ * "%u", "%x" and "%X", with an optional '0' flag and width, and "%%"
+ * for the percent sign. If "check" is BARCODE_EAN, BARCODE_UPC or
+ * BARCODE_ISBN a check digit is appended, and then the format must
+ * only produce digits. Returns NULL with errno set in case of error
+ */
+struct Barcode_Range *Barcode_Range_Create(char *format, unsigned long start,
+					   unsigned long end, long step,
+					   int check)
+{
+    struct Barcode_Range *r;
+    char *s, *d, *conv = NULL;
+    int width;
+
+    if (!step || (check && check != BARCODE_EAN && check != BARCODE_UPC
+		  && check != BARCODE_ISBN))
+	goto invalid;
+    for (s = format; *s; s++) {
+	if (*s == '%' && s[1] == '%' && !check) {
+	    s++;
+	    continue;
+	}
+	if (*s != '%') {
+	    if (check && !isdigit((unsigned char)*s))
+		goto invalid; /* only digits for check digits */
+	    continue;
+	}
+	if (conv)
+	    goto invalid; /* only one number */
+	conv = s++;
+	if (*s == '0')
+	    s++;
+	for (width = 0; isdigit((unsigned char)*s); s++)
+	    width = width * 10 + *s - '0';
+	if (width > RANGE_MAXWIDTH || !*s
+	    || !strchr(check ? "du" : "duxX", *s))
+	    goto invalid;
+    }
+    if (!conv)
+	goto invalid;
+
+    if (!(r = calloc(1, sizeof(*r))))
+	return NULL;
+    r->format = malloc(strlen(format) + 2);
+    /* the number, the check digit and the terminator */
+    r->buf = malloc(strlen(format) + RANGE_MAXWIDTH + 24);
+    if (!r->format || !r->buf) {
+	Barcode_Range_Delete(r);
+	return NULL;
+    }
+    for (s = format, d = r->format; *s; ) {
+	if (s != conv) {
+	    *d++ = *s++;
+	    continue;
+	}
+	/* copy the flag and width, then add the length modifier */
+	for (*d++ = *s++; isdigit((unsigned char)*s); )
+	    *d++ = *s++;
+	*d++ = 'l';
+	*d++ = *s == 'd' ? 'u' : *s; /* the numbers are unsigned */
+	s++;
+    }
+    *d = '\0';
+
+    r->next = start;
+    r->end = end;
+    r->step = step;
+    r->check = check;
+    r->done = step > 0 ? start > end : start < end;
+    return r;
+
+ invalid:
+    errno = EINVAL;
+    return NULL;
+}
+
+/*
+ * Return the next text of the range, or NULL after the last one. The
+ * text is overwritten by the next call
+ */
+char *Barcode_Range_Next(struct Barcode_Range *r)
+{
+    unsigned long step;
+    int len;
+
+    if (r->done)
+	return NULL;
+    len = sprintf(r->buf, r->format, r->next);
+    if (r->check) {
+	r->buf[len] = Barcode_range_check(r->buf, len, r->check);
+	r->buf[len + 1] = '\0';
+    }
+
+    /* don't go past the end, even if it is close to the largest number */
+    if (r->step > 0) {
+	step = r->step;
+	r->done = r->end - r->next < step;
+	r->next += step;
+    } else {
+	step = -(unsigned long)r->step;
+	r->done = r->next - r->end < step;
+	r->next -= step;
+    }
+    return r->buf;
+}
+
+void Barcode_Range_Delete(struct Barcode_Range *r)
+{
+    free(r->format);
+    free(r->buf);
+    free(r);
+}
@@ -0,0 +1,504 @@
+/*
+ * stress.c -- encode and print from many threads, and compare the
+ * results byte by byte with those of a single thread
+ *
+ * Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "barcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+/*
+ * Usage: "stress [<threads> [<rounds>]]". The texts below are encoded
+ * and printed once by the main thread, with no cache, to get the
+ * reference results. Then the encoded cache is enabled (smaller than
+ * the set of texts, so it evicts too) and each thread goes over all
+ * the texts "rounds" times, from its own starting point, in one of
+ * these ways, changing at each round:
+ *
+ *   - a new item for each text, printed to memory in all the formats
+ *   - items from an arena of the thread, reset every round
+ *   - the item of a context of the thread, encoded incrementally
+ *   - a few items at a time, with Barcode_Encode_Batch and 2 threads
+ *
+ * The runs and the glyphs (as "partial" and "textinfo"), the error
+ * position and the printed bytes must always be those of the
+ * reference. The reference itself must match "stress.gold" (in the
+ * directory $srcdir, or the current one): the texts there were
+ * encoded and printed as postscript by barcode 0.99, before the
+ * library was made reentrant, so this checks both runs against a
+ * known good output. The exit status is 0 if all match, 1 if not, and
+ * 77 (the automake code for a skipped test) without thread support
+ */
+
+#define STRESS_MODES 4
+#define STRESS_BATCH 16
+
+static int formats[] = {
+    BARCODE_OUT_PS | BARCODE_OUT_NOHEADERS,
+    BARCODE_OUT_EPS,
+    BARCODE_OUT_SVG,
+    BARCODE_OUT_PCL,
+};
+#define NFORMATS ((int)(sizeof(formats) / sizeof(formats[0])))
+
+struct stress_text {
+    char *text;
+    int flags;         /* encoding and encoding flags */
+    int geometry;      /* whether to use Barcode_Position */
+    /* the reference */
+    int failed, errpos;
+    char *partial, *textinfo;
+    char *out[NFORMATS];
+    int outlen[NFORMATS];
+    /* the golden output, if the text comes from stress.gold */
+    int gold, goldfailed;
+    char *goldpartial, *goldtextinfo, *goldps;
+    int goldpslen;
+};
+
+static struct stress_text *texts;
+static int ntexts, ntextsize;
+
+static void stress_add(char *text, int flags)
+{
+    struct stress_text *t;
+
+    if (ntexts == ntextsize) {
+	ntextsize = ntextsize ? 2 * ntextsize : 256;
+	texts = realloc(texts, ntextsize * sizeof(*texts));
+	if (!texts) {
+	    perror("stress");
+	    exit(1);
+	}
+    }
+    t = texts + ntexts;
+    memset(t, 0, sizeof(*t));
+    t->text = strdup(text);
+    t->flags = flags;
+    t->geometry = ntexts % 3 == 0;
+    ntexts++;
+}
+
+/*
+ * The golden file is a list of items: "item <flags> <geometry>", then
+ * "failed" or the fields "partial", "textinfo" and "ps". The text and
+ * each field are "<name> <length>" and the bytes on the next line; a
+ * length of -1 is a NULL string (for "ps": not compared). Lines
+ * starting with "#" are comments
+ */
+static char *stress_field(FILE *f, char *name, int *lenp)
+{
+    char word[16], *s;
+    int len;
+
+    if (lenp)
+	*lenp = 0;
+    if (fscanf(f, "%15s %i", word, &len) != 2 || strcmp(word, name)
+	|| getc(f) != '\n')
+	return NULL;
+    if (lenp)
+	*lenp = len;
+    if (len < 0)
+	return NULL;
+    s = malloc(len + 1);
+    if (!s || fread(s, 1, len, f) != (size_t)len || getc(f) != '\n') {
+	free(s);
+	return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+static int stress_gold(char *argv0)
+{
+    struct stress_text *t;
+    char *dir = getenv("srcdir"), *path, *text, line[256];
+    int flags, geometry, len, c;
+    FILE *f;
+
+    if (!dir)
+	dir = ".";
+    path = malloc(strlen(dir) + 16);
+    if (!path)
+	return -1;
+    sprintf(path, "%s/stress.gold", dir);
+    f = fopen(path, "rb");
+    if (!f) {
+	fprintf(stderr, "%s: %s: %s\n", argv0, path, strerror(errno));
+	free(path);
+	return -1;
+    }
+    while ((c = getc(f)) != EOF) {
+	ungetc(c, f);
+	if (c == '#') {
+	    if (!fgets(line, sizeof(line), f))
+		break;
+	    continue;
+	}
+	if (fscanf(f, "item %i %i\n", &flags, &geometry) != 2
+	    || !(text = stress_field(f, "text", NULL)))
+	    goto bad;
+	stress_add(text, flags);
+	free(text);
+	t = texts + ntexts - 1;
+	t->geometry = geometry;
+	t->gold = 1;
+	if ((c = getc(f)) == 'f') {
+	    ungetc(c, f);
+	    if (!fgets(line, sizeof(line), f) || strcmp(line, "failed\n"))
+		goto bad;
+	    t->goldfailed = 1;
+	    continue;
+	}
+	ungetc(c, f);
+	t->goldpartial = stress_field(f, "partial", &len);
+	if (len >= 0 && !t->goldpartial)
+	    goto bad;
+	t->goldtextinfo = stress_field(f, "textinfo", &len);
+	if (len >= 0 && !t->goldtextinfo)
+	    goto bad;
+	t->goldps = stress_field(f, "ps", &t->goldpslen);
+	if (t->goldpslen >= 0 && !t->goldps)
+	    goto bad;
+    }
+    fclose(f);
+    free(path);
+    return 0;
+
+ bad:
+    fprintf(stderr, "%s: %s: bad item %i\n", argv0, path, ntexts);
+    fclose(f);
+    free(path);
+    return -1;
+}
+
+/* a pseudo-random string over "set", the same at each run */
+static unsigned long stress_seed = 1;
+
+static char *stress_string(char *buf, char *set, int len)
+{
+    int i, n = strlen(set);
+
+    for (i = 0; i < len; i++) {
+	stress_seed = stress_seed * 1103515245 + 12345;
+	buf[i] = set[(stress_seed >> 16) % n];
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+static void stress_texts(void)
+{
+    static char *fixed[] = {
+	"800894002700", "000000000000", "9780201379624", "1234567",
+	"800894002700 12", "800894002700 12345", "00000000000",
+	"01234565", "012345", "01234567890 12", "1-56592-292-1 90000",
+	"0-13-110362-8", "A1234B", "c0987654321d", NULL
+    };
+    static char dec[] = "0123456789", hex[] = "0123456789ABCDEF";
+    static char up[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%";
+    static char ascii[] = "0123456789ABCDEFGHIJabcdefghij !#&()*,;<=>?@[]_{}~";
+    static char c128[] = "0123456789AZaz\001\t\301\302\304-";
+    char buf[256], raw[512];
+    int i, j, n;
+
+    for (i = 0; fixed[i]; i++)
+	stress_add(fixed[i], 0);
+    for (i = 0; i < 40; i++) {
+	n = 4 + i % 21;
+	stress_add(stress_string(buf, dec, 12), BARCODE_EAN);
+	stress_add(stress_string(buf, dec, 11), BARCODE_UPC);
+	stress_add(stress_string(buf, dec, 9), BARCODE_ISBN);
+	stress_add(stress_string(buf, up, n), BARCODE_39);
+	stress_add(stress_string(buf, up, n),
+		   BARCODE_39 | BARCODE_NO_CHECKSUM);
+	stress_add(stress_string(buf, ascii, n), BARCODE_39EXT);
+	stress_add(stress_string(buf, ascii, n), BARCODE_128B);
+	stress_add(stress_string(buf, dec, 2 * (n / 2)), BARCODE_128C);
+	stress_add(stress_string(buf, c128, n), BARCODE_128);
+	stress_add(stress_string(buf, c128, n),
+		   BARCODE_128 | BARCODE_SHORTEST);
+	stress_add(stress_string(buf, dec, n), BARCODE_I25);
+	stress_add(stress_string(buf, dec, n),
+		   BARCODE_I25 | BARCODE_NO_CHECKSUM);
+	stress_add(stress_string(buf, dec, n), BARCODE_MSI);
+	stress_add(stress_string(buf, hex, n), BARCODE_PLS);
+	stress_add(stress_string(buf, up, n), BARCODE_93);
+	stress_add(stress_string(buf, "0123456789-", n), BARCODE_11);
+	stress_add(stress_string(buf, ascii, n), 0);
+	for (j = sprintf(raw, "104"); j < 3 * n; )
+	    j += sprintf(raw + j, " %lu", (stress_seed = stress_seed * 69069
+					  + 1) % 103);
+	stress_add(raw, BARCODE_128RAW);
+	/* some that can't be encoded */
+	stress_add(stress_string(buf, ascii, n), BARCODE_EAN);
+	stress_add(stress_string(buf, hex, n | 1), BARCODE_128C);
+    }
+    /* serial numbers, for the incremental encoding of the contexts */
+    for (i = 0; i < 100; i++) {
+	sprintf(buf, "LOT-%06d", 4711 + i);
+	stress_add(buf, i < 50 ? BARCODE_39 : BARCODE_128B);
+	sprintf(buf, "40063810%04d", 17 * i);
+	stress_add(buf, BARCODE_EAN);
+    }
+}
+
+/* a buffer that grows, one per thread */
+struct stress_buf {
+    char *data;
+    int size;
+};
+
+static int stress_print(struct Barcode_Item *bc, int format,
+			struct stress_buf *b)
+{
+    int len = Barcode_Print_Buffer(bc, b->data, b->size, format);
+
+    if (len > b->size) {
+	b->size = len + 1024;
+	b->data = realloc(b->data, b->size);
+	if (!b->data)
+	    return -1;
+	len = Barcode_Print_Buffer(bc, b->data, b->size, format);
+    }
+    return len;
+}
+
+static int stress_same(char *a, char *b)
+{
+    if (!a || !b)
+	return a == b;
+    return !strcmp(a, b);
+}
+
+/* compare an encoded item with the reference; returns 0 or 1 */
+static int stress_check(struct stress_text *t, struct Barcode_Item *bc,
+			int failed)
+{
+    if (failed != t->failed)
+	return 1;
+    if (failed)
+	return bc->errpos != t->errpos;
+    return !stress_same(Barcode_Partial(bc), t->partial)
+	|| !stress_same(Barcode_Textinfo(bc), t->textinfo);
+}
+
+/* the same, printed too */
+static int stress_check_print(struct stress_text *t, struct Barcode_Item *bc,
+			      int failed, struct stress_buf *b)
+{
+    int i, len;
+
+    if (stress_check(t, bc, failed))
+	return 1;
+    for (i = 0; !failed && i < NFORMATS; i++) {
+	len = stress_print(bc, formats[i], b);
+	if (len != t->outlen[i] || memcmp(b->data, t->out[i], len))
+	    return 1;
+    }
+    return 0;
+}
+
+static void stress_position(struct stress_text *t, struct Barcode_Item *bc)
+{
+    if (t->geometry)
+	Barcode_Position(bc, 200, 60, 10, 10, 0.0);
+}
+
+/* compute the reference, and compare it with the golden output */
+static int stress_reference(char *argv0)
+{
+    struct stress_buf b = {NULL, 0};
+    struct Barcode_Item *bc;
+    struct stress_text *t;
+    int i, j, errors = 0;
+
+    for (t = texts; t < texts + ntexts; t++) {
+	bc = Barcode_Create(t->text);
+	stress_position(t, bc);
+	t->failed = Barcode_Encode(bc, t->flags) < 0;
+	t->errpos = bc->errpos;
+	if (!t->failed) {
+	    t->partial = strdup(Barcode_Partial(bc));
+	    t->textinfo = strdup(Barcode_Textinfo(bc));
+	    for (i = 0; i < NFORMATS; i++) {
+		t->outlen[i] = j = stress_print(bc, formats[i], &b);
+		t->out[i] = malloc(j);
+		memcpy(t->out[i], b.data, j);
+	    }
+	}
+	Barcode_Delete(bc);
+	if (t->gold && (t->failed != t->goldfailed
+			|| (!t->failed
+			    && (!stress_same(t->partial, t->goldpartial)
+				|| !stress_same(t->textinfo, t->goldtextinfo)
+				|| (t->goldps
+				    && (t->outlen[0] != t->goldpslen
+					|| memcmp(t->out[0], t->goldps,
+						  t->goldpslen))))))) {
+	    fprintf(stderr, "%s: \"%s\": not the golden output\n", argv0,
+		    t->text);
+	    errors++;
+	}
+    }
+    free(b.data);
+    return errors;
+}
+
+struct stress_thread {
+    int id, rounds;
+    unsigned long encoded, errors;
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;
+#endif
+};
+
+static void *stress_worker(void *arg)
+{
+    struct stress_thread *st = arg;
+    struct stress_buf b = {NULL, 0};
+    struct Barcode_Arena *arena = Barcode_Arena_Create(0);
+    struct Barcode_Context *ctx = Barcode_Context_Create(0);
+    struct Barcode_Item *bc, *batch[STRESS_BATCH];
+    struct stress_text *t;
+    int round, mode, i, j, k, n;
+
+    if (!arena || !ctx) {
+	st->errors++;
+	return NULL;
+    }
+    Barcode_Context_Incremental(ctx, 1);
+    for (round = 0; round < st->rounds; round++) {
+	mode = (st->id + round) % STRESS_MODES;
+	/* in order, so that the serial numbers follow each other */
+	k = (st->id * 7919 + round * 131) % ntexts;
+	for (i = 0; i < ntexts; i += n) {
+	    t = texts + (k + i) % ntexts;
+	    n = 1;
+	    switch (mode) {
+	    case 0:
+		bc = Barcode_Create(t->text);
+		stress_position(t, bc);
+		st->errors += stress_check_print(t, bc,
+				    Barcode_Encode(bc, t->flags) < 0, &b);
+		Barcode_Delete(bc);
+		break;
+	    case 1:
+		bc = Barcode_Create_Arena(t->text, arena);
+		stress_position(t, bc);
+		st->errors += stress_check_print(t, bc,
+				    Barcode_Encode(bc, t->flags) < 0, &b);
+		break;
+	    case 2:
+		bc = Barcode_Reset(ctx, t->text);
+		st->errors += stress_check(t, bc,
+					   Barcode_Encode(bc, t->flags) < 0);
+		break;
+	    case 3:
+		/* items with the same flags, as the batch has one */
+		for (n = 0; n < STRESS_BATCH && i + n < ntexts; n++) {
+		    j = (k + i + n) % ntexts;
+		    if (n && texts[j].flags != t->flags)
+			break;
+		    batch[n] = Barcode_Create(texts[j].text);
+		    stress_position(texts + j, batch[n]);
+		}
+		Barcode_Encode_Batch(batch, n, t->flags, 2);
+		for (j = 0; j < n; j++) {
+		    bc = batch[j];
+		    st->errors += stress_check(texts + (k + i + j) % ntexts,
+					       bc, bc->error != 0);
+		    Barcode_Delete(bc);
+		}
+		break;
+	    }
+	    st->encoded += n;
+	}
+	Barcode_Arena_Reset(arena);
+    }
+    Barcode_Arena_Delete(arena);
+    Barcode_Context_Delete(ctx);
+    free(b.data);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct stress_thread *st;
+    unsigned long encoded = 0, errors = 0;
+    int i, nthreads = 0, rounds = STRESS_MODES;
+
+    if (argc > 1)
+	nthreads = atoi(argv[1]);
+    if (argc > 2)
+	rounds = atoi(argv[2]);
+#ifdef _SC_NPROCESSORS_ONLN
+    if (nthreads <= 0)
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads < 4)
+	nthreads = 4; /* even on one processor, threads are preempted */
+
+    if (stress_gold(argv[0]) < 0)
+	return 1;
+    stress_texts();
+    errors = stress_reference(argv[0]);
+#ifndef HAVE_PTHREAD_H
+    if (errors)
+	return 1;
+    fprintf(stderr, "%s: no thread support, skipped\n", argv[0]);
+    return 77;
+#endif
+    Barcode_Cache_Enable(ntexts / 4);
+
+    st = calloc(nthreads, sizeof(*st));
+    if (!st) {
+	perror(argv[0]);
+	return 1;
+    }
+    for (i = 0; i < nthreads; i++) {
+	st[i].id = i;
+	st[i].rounds = rounds;
+#ifdef HAVE_PTHREAD_H
+	if (pthread_create(&st[i].thread, NULL, stress_worker, st + i)) {
+	    perror(argv[0]);
+	    return 1;
+	}
+#endif
+    }
+    for (i = 0; i < nthreads; i++) {
+#ifdef HAVE_PTHREAD_H
+	pthread_join(st[i].thread, NULL);
+#endif
+	encoded += st[i].encoded;
+	errors += st[i].errors;
+    }
+    printf("%s: %i texts, %i threads, %lu encoded, %lu different\n",
+	   argv[0], ntexts, nthreads, encoded, errors);
+    free(st);
+    return errors ? 1 : 0;
+}